@@ -0,0 +1,458 @@
+// AES-128 block functions with hardware acceleration
+// The AES instructions and the decryption tables are only used once a known
+// answer test has shown they give the same blocks and keys as the portable code.
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "AesFast.h"
+
+#ifdef AES_NI
+	#ifdef __GNUC__
+		#include <immintrin.h>
+		#define AES_TARGET_NI __attribute__((target("aes,sse2")))
+	#else
+		#include <intrin.h>
+		#include <wmmintrin.h>
+		#define AES_TARGET_NI
+	#endif
+#endif
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "aesfast";
+#endif
+#include "Debug.h"
+
+// Globals
+static int aesLevel = -1;
+static int aesMaxLevel = AES_FAST_LEVEL;
+// Decryption tables, made on first use
+static uint32_t aesTd[4][256];
+static unsigned char aesInvSbox[256];
+
+// Code
+// Multiply in GF(2^8)
+static unsigned char AesMul(unsigned char a, unsigned char b)
+{
+	unsigned char product = 0;
+	for(; b; b >>= 1)
+	{
+		if(b & 1) product ^= a;
+		a = (unsigned char)((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+	}
+	return product;
+}
+
+#define AES_XTIME(_a)		((unsigned char)(((_a) << 1) ^ (((_a) & 0x80) ? 0x1b : 0)))
+
+// Round keys for the equivalent inverse cipher, from the forward schedule
+static void AesDecKeys(AesKey_t* key)
+{
+	const unsigned char* ksch = key->ctx.ksch;
+	unsigned char a0, a1, a2, a3, u, v, t;
+	int round, i;
+	memcpy(key->dec[0], &ksch[AES_ROUNDS_128 * N_BLOCK], N_BLOCK);
+	for(round = 1; round < AES_ROUNDS_128; round++)
+	{
+		const unsigned char* rk = &ksch[(AES_ROUNDS_128 - round) * N_BLOCK];
+		unsigned char* dec = key->dec[round];
+		// Inverse mix columns, as a multiply by 4 + 5x^2 then mix columns
+		for(i = 0; i < N_BLOCK; i += 4)
+		{
+			a0 = rk[i]; a1 = rk[i + 1]; a2 = rk[i + 2]; a3 = rk[i + 3];
+			u = AES_XTIME(AES_XTIME(a0 ^ a2));
+			v = AES_XTIME(AES_XTIME(a1 ^ a3));
+			a0 ^= u; a1 ^= v; a2 ^= u; a3 ^= v;
+			t = a0 ^ a1 ^ a2 ^ a3;
+			dec[i + 0] = a0 ^ t ^ AES_XTIME(a0 ^ a1);
+			dec[i + 1] = a1 ^ t ^ AES_XTIME(a1 ^ a2);
+			dec[i + 2] = a2 ^ t ^ AES_XTIME(a2 ^ a3);
+			dec[i + 3] = a3 ^ t ^ AES_XTIME(a3 ^ a0);
+		}
+	}
+	memcpy(key->dec[AES_ROUNDS_128], &ksch[0], N_BLOCK);
+}
+
+// Inverse s-box and the four rotations of the combined inverse s-box and mix columns.
+// Words hold a column with row 0 in the low byte, so they load straight from the
+// block on little endian hosts.
+static void AesTableInit(void)
+{
+	unsigned char p = 1, q = 1, s;
+	uint32_t t;
+	int i;
+	// Walk the multiplicative group, q tracks the inverse of p
+	do {
+		p = (unsigned char)(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));
+		q ^= (unsigned char)(q << 1);
+		q ^= (unsigned char)(q << 2);
+		q ^= (unsigned char)(q << 4);
+		if(q & 0x80) q ^= 0x09;
+		// Affine transform
+		s = (unsigned char)(q ^ ((q << 1) | (q >> 7)) ^ ((q << 2) | (q >> 6)) ^ ((q << 3) | (q >> 5)) ^ ((q << 4) | (q >> 4)) ^ 0x63);
+		aesInvSbox[s] = p;
+	} while(p != 1);
+	aesInvSbox[0x63] = 0;
+	for(i = 0; i < 256; i++)
+	{
+		unsigned char a = aesInvSbox[i];
+		t = (uint32_t)AesMul(a, 14) | ((uint32_t)AesMul(a, 9) << 8) | ((uint32_t)AesMul(a, 13) << 16) | ((uint32_t)AesMul(a, 11) << 24);
+		aesTd[0][i] = t;
+		aesTd[1][i] = (t << 8) | (t >> 24);
+		aesTd[2][i] = (t << 16) | (t >> 16);
+		aesTd[3][i] = (t << 24) | (t >> 8);
+	}
+}
+
+#define AES_WORD(_p)		((uint32_t)(_p)[0] | ((uint32_t)(_p)[1] << 8) | ((uint32_t)(_p)[2] << 16) | ((uint32_t)(_p)[3] << 24))
+#define AES_PUT_WORD(_p, _w)	do{ (_p)[0] = (unsigned char)(_w); (_p)[1] = (unsigned char)((_w) >> 8); (_p)[2] = (unsigned char)((_w) >> 16); (_p)[3] = (unsigned char)((_w) >> 24); }while(0)
+// One output column, inverse shift rows takes row r from column c - r
+#define AES_TD_COLUMN(_a, _b, _c, _d, _rk) (aesTd[0][(_a) & 0xff] ^ aesTd[1][((_b) >> 8) & 0xff] ^ aesTd[2][((_c) >> 16) & 0xff] ^ aesTd[3][(_d) >> 24] ^ AES_WORD(_rk))
+#define AES_TD_LAST(_a, _b, _c, _d, _rk) (((uint32_t)aesInvSbox[(_a) & 0xff] | ((uint32_t)aesInvSbox[((_b) >> 8) & 0xff] << 8) | ((uint32_t)aesInvSbox[((_c) >> 16) & 0xff] << 16) | ((uint32_t)aesInvSbox[(_d) >> 24] << 24)) ^ AES_WORD(_rk))
+
+static void AesTableDecryptBlock(const AesKey_t* key, const unsigned char* in, unsigned char* out)
+{
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+	int round;
+	s0 = AES_WORD(in) ^ AES_WORD(&key->dec[0][0]);
+	s1 = AES_WORD(in + 4) ^ AES_WORD(&key->dec[0][4]);
+	s2 = AES_WORD(in + 8) ^ AES_WORD(&key->dec[0][8]);
+	s3 = AES_WORD(in + 12) ^ AES_WORD(&key->dec[0][12]);
+	for(round = 1; round < AES_ROUNDS_128; round++)
+	{
+		const unsigned char* rk = key->dec[round];
+		t0 = AES_TD_COLUMN(s0, s3, s2, s1, rk);
+		t1 = AES_TD_COLUMN(s1, s0, s3, s2, rk + 4);
+		t2 = AES_TD_COLUMN(s2, s1, s0, s3, rk + 8);
+		t3 = AES_TD_COLUMN(s3, s2, s1, s0, rk + 12);
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+	t0 = AES_TD_LAST(s0, s3, s2, s1, key->dec[AES_ROUNDS_128]);
+	t1 = AES_TD_LAST(s1, s0, s3, s2, key->dec[AES_ROUNDS_128] + 4);
+	t2 = AES_TD_LAST(s2, s1, s0, s3, key->dec[AES_ROUNDS_128] + 8);
+	t3 = AES_TD_LAST(s3, s2, s1, s0, key->dec[AES_ROUNDS_128] + 12);
+	AES_PUT_WORD(out, t0);
+	AES_PUT_WORD(out + 4, t1);
+	AES_PUT_WORD(out + 8, t2);
+	AES_PUT_WORD(out + 12, t3);
+}
+
+// FIPS-197 appendix C.1
+static const unsigned char fipsKey[N_BLOCK] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+static const unsigned char fipsPlain[N_BLOCK] = {0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff};
+static const unsigned char fipsCipher[N_BLOCK] = {0x69,0xc4,0xe0,0xd8,0x6a,0x7b,0x04,0x30,0xd8,0xcd,0xb7,0x80,0x70,0xb4,0xc5,0x5a};
+
+// Known answer test, the FIPS vector then a chain of keys against the portable code
+static int AesTableCheck(void)
+{
+	unsigned char key[N_BLOCK], block[N_BLOCK], table[N_BLOCK], sw[N_BLOCK];
+	AesKey_t expanded;
+	int i;
+
+	aes_set_key(fipsKey, N_BLOCK, &expanded.ctx);
+	AesDecKeys(&expanded);
+	AesTableDecryptBlock(&expanded, fipsCipher, table);
+	if(memcmp(table, fipsPlain, N_BLOCK) != 0) return FALSE;
+
+	// Each output is the next key and block
+	memcpy(key, fipsKey, N_BLOCK);
+	memcpy(block, fipsCipher, N_BLOCK);
+	for(i = 0; i < 16; i++)
+	{
+		aes_set_key(key, N_BLOCK, &expanded.ctx);
+		AesDecKeys(&expanded);
+		aes_decrypt(block, sw, &expanded.ctx);
+		AesTableDecryptBlock(&expanded, block, table);
+		if(memcmp(table, sw, N_BLOCK) != 0) return FALSE;
+		memcpy(key, block, N_BLOCK);
+		memcpy(block, sw, N_BLOCK);
+	}
+	return TRUE;
+}
+
+#ifdef AES_NI
+// One round of the key schedule forward, the round constant must be a literal
+#define AES_NI_EXPAND(_k, _rcon)	AesNiExpandStep((_k), _mm_aeskeygenassist_si128((_k), (_rcon)))
+// One round back, the previous key's last word is key word 3 ^ word 2
+#define AES_NI_REVERSE(_k, _rcon)	do{	_k = _mm_xor_si128(_k, _mm_slli_si128(_k, 4));\
+										_k = _mm_xor_si128(_k, _mm_srli_si128(_mm_aeskeygenassist_si128(_k, (_rcon)), 12));\
+									}while(0)
+
+AES_TARGET_NI static __m128i AesNiExpandStep(__m128i k, __m128i t)
+{
+	t = _mm_shuffle_epi32(t, 0xff);
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, t);
+}
+
+// Round keys from the cipher key
+AES_TARGET_NI static void AesNiExpand(__m128i* rk, __m128i k)
+{
+	rk[0] = k;
+	rk[1] = AES_NI_EXPAND(rk[0], 0x01);
+	rk[2] = AES_NI_EXPAND(rk[1], 0x02);
+	rk[3] = AES_NI_EXPAND(rk[2], 0x04);
+	rk[4] = AES_NI_EXPAND(rk[3], 0x08);
+	rk[5] = AES_NI_EXPAND(rk[4], 0x10);
+	rk[6] = AES_NI_EXPAND(rk[5], 0x20);
+	rk[7] = AES_NI_EXPAND(rk[6], 0x40);
+	rk[8] = AES_NI_EXPAND(rk[7], 0x80);
+	rk[9] = AES_NI_EXPAND(rk[8], 0x1b);
+	rk[10] = AES_NI_EXPAND(rk[9], 0x36);
+}
+
+// Round keys from the last round key
+AES_TARGET_NI static void AesNiReverse(__m128i* rk, __m128i k)
+{
+	rk[10] = k;
+	AES_NI_REVERSE(k, 0x36); rk[9] = k;
+	AES_NI_REVERSE(k, 0x1b); rk[8] = k;
+	AES_NI_REVERSE(k, 0x80); rk[7] = k;
+	AES_NI_REVERSE(k, 0x40); rk[6] = k;
+	AES_NI_REVERSE(k, 0x20); rk[5] = k;
+	AES_NI_REVERSE(k, 0x10); rk[4] = k;
+	AES_NI_REVERSE(k, 0x08); rk[3] = k;
+	AES_NI_REVERSE(k, 0x04); rk[2] = k;
+	AES_NI_REVERSE(k, 0x02); rk[1] = k;
+	AES_NI_REVERSE(k, 0x01); rk[0] = k;
+}
+
+AES_TARGET_NI static __m128i AesNiEncryptRounds(const __m128i* rk, __m128i b)
+{
+	int i;
+	b = _mm_xor_si128(b, rk[0]);
+	for(i = 1; i < AES_ROUNDS_128; i++)
+		b = _mm_aesenc_si128(b, rk[i]);
+	return _mm_aesenclast_si128(b, rk[AES_ROUNDS_128]);
+}
+
+// Forward round keys, the middle rounds need inverse mix columns for aesdec
+AES_TARGET_NI static __m128i AesNiDecryptRounds(const __m128i* rk, __m128i b)
+{
+	int i;
+	b = _mm_xor_si128(b, rk[AES_ROUNDS_128]);
+	for(i = AES_ROUNDS_128 - 1; i > 0; i--)
+		b = _mm_aesdec_si128(b, _mm_aesimc_si128(rk[i]));
+	return _mm_aesdeclast_si128(b, rk[0]);
+}
+
+AES_TARGET_NI static void AesNiDecryptBlock(const AesKey_t* key, const unsigned char* in, unsigned char* out)
+{
+	int i;
+	__m128i b = _mm_loadu_si128((const __m128i*)in);
+	b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)key->dec[0]));
+	for(i = 1; i < AES_ROUNDS_128; i++)
+		b = _mm_aesdec_si128(b, _mm_loadu_si128((const __m128i*)key->dec[i]));
+	b = _mm_aesdeclast_si128(b, _mm_loadu_si128((const __m128i*)key->dec[AES_ROUNDS_128]));
+	_mm_storeu_si128((__m128i*)out, b);
+}
+
+// Eight blocks at a time, aesdec has several cycles latency but can issue every cycle.
+// The lanes are written out so each block stays in a register.
+#define AES_NI_EACH_LANE(_op)	_op(0); _op(1); _op(2); _op(3); _op(4); _op(5); _op(6); _op(7)
+#define AES_NI_LANE_KEY(_i, _r)	_mm_loadu_si128((const __m128i*)keys[_i]->dec[_r])
+#define AES_NI_LANE_FIRST(_i)	b##_i = _mm_xor_si128(_mm_loadu_si128((const __m128i*)blocks[_i]), AES_NI_LANE_KEY(_i, 0))
+#define AES_NI_LANE_ROUND(_i)	b##_i = _mm_aesdec_si128(b##_i, AES_NI_LANE_KEY(_i, round))
+#define AES_NI_LANE_LAST(_i)	_mm_storeu_si128((__m128i*)blocks[_i], _mm_aesdeclast_si128(b##_i, AES_NI_LANE_KEY(_i, AES_ROUNDS_128)))
+
+AES_TARGET_NI static void AesNiDecryptBlocks(const AesKey_t* const keys[], unsigned char* const blocks[], unsigned int count)
+{
+	__m128i b0, b1, b2, b3, b4, b5, b6, b7;
+	unsigned int i;
+	int round;
+	for(; count >= AES_NI_LANES; count -= AES_NI_LANES, keys += AES_NI_LANES, blocks += AES_NI_LANES)
+	{
+		AES_NI_EACH_LANE(AES_NI_LANE_FIRST);
+		for(round = 1; round < AES_ROUNDS_128; round++)
+		{
+			AES_NI_EACH_LANE(AES_NI_LANE_ROUND);
+		}
+		AES_NI_EACH_LANE(AES_NI_LANE_LAST);
+	}
+	// Remainder one at a time
+	for(i = 0; i < count; i++)
+		AesNiDecryptBlock(keys[i], blocks[i], blocks[i]);
+}
+
+AES_TARGET_NI static void AesNiEncrypt128(const unsigned char* in, unsigned char* out, const unsigned char* key, unsigned char* o_key)
+{
+	__m128i rk[AES_ROUNDS_128 + 1];
+	AesNiExpand(rk, _mm_loadu_si128((const __m128i*)key));
+	_mm_storeu_si128((__m128i*)out, AesNiEncryptRounds(rk, _mm_loadu_si128((const __m128i*)in)));
+	_mm_storeu_si128((__m128i*)o_key, rk[AES_ROUNDS_128]);
+}
+
+AES_TARGET_NI static void AesNiDecrypt128(const unsigned char* in, unsigned char* out, const unsigned char* key, unsigned char* o_key)
+{
+	__m128i rk[AES_ROUNDS_128 + 1];
+	AesNiReverse(rk, _mm_loadu_si128((const __m128i*)key));
+	_mm_storeu_si128((__m128i*)out, AesNiDecryptRounds(rk, _mm_loadu_si128((const __m128i*)in)));
+	_mm_storeu_si128((__m128i*)o_key, rk[0]);
+}
+
+static int AesNiSupported(void)
+{
+#ifdef __GNUC__
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+#else
+	int info[4];
+	__cpuid(info, 1);
+	return ((info[2] & (1 << 25)) && (info[3] & (1 << 26)));
+#endif
+}
+
+// Known answer test, the FIPS vector then a chain of keys against the portable code
+static int AesNiCheck(void)
+{
+	unsigned char key[N_BLOCK], block[N_BLOCK], hw[N_BLOCK], hwKey[N_BLOCK], sw[N_BLOCK], swKey[N_BLOCK];
+	AesKey_t expanded;
+	int i;
+
+	AesNiEncrypt128(fipsPlain, hw, fipsKey, hwKey);
+	if(memcmp(hw, fipsCipher, N_BLOCK) != 0) return FALSE;
+	AesNiDecrypt128(hw, hw, hwKey, hwKey);
+	if(memcmp(hw, fipsPlain, N_BLOCK) != 0 || memcmp(hwKey, fipsKey, N_BLOCK) != 0) return FALSE;
+	aes_set_key(fipsKey, N_BLOCK, &expanded.ctx);
+	AesDecKeys(&expanded);
+	AesNiDecryptBlock(&expanded, fipsCipher, hw);
+	if(memcmp(hw, fipsPlain, N_BLOCK) != 0) return FALSE;
+
+	// Each output is the next key and block
+	memcpy(key, fipsKey, N_BLOCK);
+	memcpy(block, fipsCipher, N_BLOCK);
+	for(i = 0; i < 16; i++)
+	{
+		aes_encrypt_128(block, sw, key, swKey);
+		AesNiEncrypt128(block, hw, key, hwKey);
+		if(memcmp(hw, sw, N_BLOCK) != 0 || memcmp(hwKey, swKey, N_BLOCK) != 0) return FALSE;
+		aes_decrypt_128(block, sw, key, swKey);
+		AesNiDecrypt128(block, hw, key, hwKey);
+		if(memcmp(hw, sw, N_BLOCK) != 0 || memcmp(hwKey, swKey, N_BLOCK) != 0) return FALSE;
+		aes_set_key(key, N_BLOCK, &expanded.ctx);
+		AesDecKeys(&expanded);
+		aes_decrypt(block, sw, &expanded.ctx);
+		AesNiDecryptBlock(&expanded, block, hw);
+		if(memcmp(hw, sw, N_BLOCK) != 0) return FALSE;
+		memcpy(key, swKey, N_BLOCK);
+		memcpy(block, sw, N_BLOCK);
+	}
+	return TRUE;
+}
+#endif
+
+int AesFastInit(void)
+{
+	if(aesLevel >= 0) return aesLevel;
+#ifdef AES_NI
+	if(aesMaxLevel >= AES_LEVEL_NI && AesNiSupported())
+	{
+		if(AesNiCheck())
+		{
+			DBG_INFO("\r\nAES instructions in use");
+			aesLevel = AES_LEVEL_NI;
+			return aesLevel;
+		}
+		DBG_ERROR("AES instructions failed known answer test");
+	}
+#endif
+	if(aesMaxLevel >= AES_LEVEL_TABLE)
+	{
+		AesTableInit();
+		if(AesTableCheck())
+		{
+			DBG_INFO("\r\nAES tables in use");
+			aesLevel = AES_LEVEL_TABLE;
+			return aesLevel;
+		}
+		DBG_ERROR("AES tables failed known answer test");
+	}
+	aesLevel = AES_LEVEL_PORTABLE;
+	return aesLevel;
+}
+
+int AesFastSelect(int maxLevel)
+{
+	// Keys always carry every schedule so the level can change at any time
+	aesMaxLevel = (maxLevel < AES_FAST_LEVEL) ? maxLevel : AES_FAST_LEVEL;
+	aesLevel = -1;
+	return AesFastInit();
+}
+
+void AesSetKey(AesKey_t* key, const unsigned char cipherKey[N_BLOCK])
+{
+	AesFastInit();
+	aes_set_key(cipherKey, N_BLOCK, &key->ctx);
+	AesDecKeys(key);
+}
+
+void AesDecryptBlock(const AesKey_t* key, const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK])
+{
+#ifdef AES_NI
+	if(aesLevel == AES_LEVEL_NI)
+	{
+		AesNiDecryptBlock(key, in, out);
+		return;
+	}
+#endif
+	if(aesLevel == AES_LEVEL_TABLE)
+		AesTableDecryptBlock(key, in, out);
+	else
+		aes_decrypt(in, out, &key->ctx);
+}
+
+void AesDecryptBlocks(const AesKey_t* const keys[], unsigned char* const blocks[], unsigned int count)
+{
+	unsigned int i;
+#ifdef AES_NI
+	if(aesLevel == AES_LEVEL_NI)
+	{
+		AesNiDecryptBlocks(keys, blocks, count);
+		return;
+	}
+#endif
+	if(aesLevel == AES_LEVEL_TABLE)
+	{
+		for(i = 0; i < count; i++)
+			AesTableDecryptBlock(keys[i], blocks[i], blocks[i]);
+		return;
+	}
+	for(i = 0; i < count; i++)
+		aes_decrypt(blocks[i], blocks[i], &keys[i]->ctx);
+}
+
+void AesEncrypt128(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const unsigned char key[N_BLOCK], unsigned char o_key[N_BLOCK])
+{
+#ifdef AES_NI
+	if(AesFastInit() == AES_LEVEL_NI)
+	{
+		AesNiEncrypt128(in, out, key, o_key);
+		return;
+	}
+#endif
+	aes_encrypt_128(in, out, key, o_key);
+}
+
+void AesDecrypt128(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const unsigned char key[N_BLOCK], unsigned char o_key[N_BLOCK])
+{
+#ifdef AES_NI
+	if(AesFastInit() == AES_LEVEL_NI)
+	{
+		AesNiDecrypt128(in, out, key, o_key);
+		return;
+	}
+#endif
+	aes_decrypt_128(in, out, key, o_key);
+}
+
+//EOF
@@ -0,0 +1,59 @@
+// AES-128 block functions with hardware acceleration
+// Uses the AES instructions when the cpu reports them, otherwise 32-bit table
+// lookups for decryption and the portable byte-wise code in aes.c for the rest.
+// The results are the same either way, each path is checked against the
+// portable one before it is used.
+#ifndef AES_FAST_H
+#define AES_FAST_H
+
+#include "aes.h"
+
+// Hardware path, x86 only, picked at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define AES_NI
+#elif defined(_MSC_VER) && (_MSC_VER >= 1700) && (defined(_M_X64) || defined(_M_IX86))
+	#define AES_NI
+#endif
+
+#define AES_ROUNDS_128		10
+
+#define AES_LEVEL_PORTABLE	0
+#define AES_LEVEL_TABLE		1
+#define AES_LEVEL_NI		2
+
+// Fastest level allowed, build with e.g. -DAES_FAST_LEVEL=1 to leave out the hardware path
+#ifndef AES_FAST_LEVEL
+	#define AES_FAST_LEVEL	AES_LEVEL_NI
+#endif
+
+// Blocks in flight together when decrypting a batch
+#define AES_NI_LANES		8
+
+// Expanded 128 bit key, set with AesSetKey
+typedef struct {
+	aes_context ctx;		/* Portable schedule */
+	unsigned char dec[AES_ROUNDS_128 + 1][N_BLOCK];	/* Inverse cipher round keys, last round first */
+} AesKey_t;
+
+// Pick the implementation, called on first use - returns the AES_LEVEL_x in use
+int AesFastInit(void);
+// Use no faster than maxLevel (to compare them), returns the AES_LEVEL_x in use
+int AesFastSelect(int maxLevel);
+
+// Expand a cipher key for AesDecryptBlock
+void AesSetKey(AesKey_t* key, const unsigned char cipherKey[N_BLOCK]);
+
+// Decrypt one block with an expanded key, in and out may be the same
+void AesDecryptBlock(const AesKey_t* key, const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK]);
+
+// Decrypt count blocks in place, each with its own key, independent blocks
+// are interleaved to keep the hardware pipeline full
+void AesDecryptBlocks(const AesKey_t* const keys[], unsigned char* const blocks[], unsigned int count);
+
+// Same as aes_encrypt_128/aes_decrypt_128, the keys are 'on the fly' keys
+// and o_key gets the key that reverses the operation (may be the same as key)
+void AesEncrypt128(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const unsigned char key[N_BLOCK], unsigned char o_key[N_BLOCK]);
+void AesDecrypt128(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const unsigned char key[N_BLOCK], unsigned char o_key[N_BLOCK]);
+
+#endif
+//EOF
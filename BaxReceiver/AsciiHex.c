@@ -1,7 +1,169 @@
 // Karim Ladha 2014
 // Utils for converting between binary and ascii hex
-#ifndef _ASCII_HEX_H_
-#define _ASCII_HEX_H_
+// Whole blocks are converted with SSE2 or AVX2 when the cpu has them, the
+// scalar loops finish off the tails and anything the vector code rejects.
+#include <stddef.h>
+#include "AsciiHex.h"
+
+// Vector paths, x86 only, picked at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <immintrin.h>
+	#define HEX_SIMD
+	#define HEX_TARGET_SSE2 __attribute__((target("sse2")))
+	#define HEX_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (_MSC_VER >= 1700) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#include <immintrin.h>
+	#define HEX_SIMD
+	#define HEX_TARGET_SSE2
+	#define HEX_TARGET_AVX2
+#endif
+
+// Hex lines are read in blocks that may run past the terminator, the
+// block is only loaded if it can not cross into the next page.
+#define HEX_PAGE_SIZE		4096
+#define HEX_BLOCK_READABLE(_p, _n) ((((size_t)(_p)) & (HEX_PAGE_SIZE - 1)) <= (HEX_PAGE_SIZE - (_n)))
+
+// Set once by HexSelect before any threads start, only read after that
+static int hexLevel = -1;
+
+static int HexLevel(void)
+{
+	// Scalar until selected
+	return (hexLevel >= 0) ? hexLevel : HEX_LEVEL_SCALAR;
+}
+
+int HexSelect(int maxLevel)
+{
+	int level = HEX_LEVEL_SCALAR;
+#if defined(HEX_SIMD) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2")) level = HEX_LEVEL_SSE2;
+	if(__builtin_cpu_supports("avx2")) level = HEX_LEVEL_AVX2;
+#elif defined(HEX_SIMD)
+	{
+		int info[4];
+		__cpuid(info, 1);
+		if(info[3] & (1 << 26)) level = HEX_LEVEL_SSE2;
+		// AVX2 also needs the OS to save the ymm registers
+		if((info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6))
+		{
+			__cpuidex(info, 7, 0);
+			if(info[1] & (1 << 5)) level = HEX_LEVEL_AVX2;
+		}
+	}
+#endif
+	hexLevel = (level < maxLevel) ? level : maxLevel;
+	return hexLevel;
+}
+
+#ifdef HEX_SIMD
+// Nibbles 0-15 to '0'-'9','A'-'F'
+HEX_TARGET_SSE2 static __m128i HexCharsSse2(__m128i nibbles)
+{
+	__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '9' - 1));
+	return _mm_add_epi8(nibbles, _mm_add_epi8(letters, _mm_set1_epi8('0')));
+}
+
+// Chars to nibbles, clears *valid if any char is not hex
+HEX_TARGET_SSE2 static __m128i HexNibblesSse2(__m128i chars, int* valid)
+{
+	__m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	if(_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF) *valid = 0;
+	return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+						_mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 0x0A))));
+}
+
+// Char pairs to bytes in the low half of each 16 bit lane, first char is the msb
+HEX_TARGET_SSE2 static __m128i HexPairsSse2(__m128i nibbles)
+{
+	return _mm_and_si128(_mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8)), _mm_set1_epi16(0x00FF));
+}
+
+// 16 bytes to 32 chars
+HEX_TARGET_SSE2 static void WriteHexSse2(char* dest, const unsigned char* source, unsigned char littleEndian)
+{
+	__m128i bytes = _mm_loadu_si128((const __m128i*)source);
+	__m128i hi, lo;
+	if(littleEndian)
+	{
+		// Reverse the bytes: dwords, words in dwords, then bytes in words
+		bytes = _mm_shuffle_epi32(bytes, 0x1B);
+		bytes = _mm_shufflehi_epi16(_mm_shufflelo_epi16(bytes, 0xB1), 0xB1);
+		bytes = _mm_or_si128(_mm_slli_epi16(bytes, 8), _mm_srli_epi16(bytes, 8));
+	}
+	hi = HexCharsSse2(_mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F)));
+	lo = HexCharsSse2(_mm_and_si128(bytes, _mm_set1_epi8(0x0F)));
+	_mm_storeu_si128((__m128i*)dest, _mm_unpacklo_epi8(hi, lo));
+	_mm_storeu_si128((__m128i*)(dest + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+// 32 chars to 16 bytes, nothing is written unless all are hex
+HEX_TARGET_SSE2 static int ReadHexSse2(unsigned char* dest, const char* source)
+{
+	int valid = 1;
+	__m128i a = HexNibblesSse2(_mm_loadu_si128((const __m128i*)source), &valid);
+	__m128i b = HexNibblesSse2(_mm_loadu_si128((const __m128i*)(source + 16)), &valid);
+	if(!valid) return 0;
+	_mm_storeu_si128((__m128i*)dest, _mm_packus_epi16(HexPairsSse2(a), HexPairsSse2(b)));
+	return 1;
+}
+
+HEX_TARGET_AVX2 static __m256i HexCharsAvx2(__m256i nibbles)
+{
+	__m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('A' - '9' - 1));
+	return _mm256_add_epi8(nibbles, _mm256_add_epi8(letters, _mm256_set1_epi8('0')));
+}
+
+HEX_TARGET_AVX2 static __m256i HexNibblesAvx2(__m256i chars, int* valid)
+{
+	__m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+	if(_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1) *valid = 0;
+	return _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+						   _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 0x0A))));
+}
+
+HEX_TARGET_AVX2 static __m256i HexPairsAvx2(__m256i nibbles)
+{
+	return _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(nibbles, 4), _mm256_srli_epi16(nibbles, 8)), _mm256_set1_epi16(0x00FF));
+}
+
+// 32 bytes to 64 chars
+HEX_TARGET_AVX2 static void WriteHexAvx2(char* dest, const unsigned char* source, unsigned char littleEndian)
+{
+	__m256i bytes = _mm256_loadu_si256((const __m256i*)source);
+	__m256i hi, lo, first, second;
+	if(littleEndian)
+	{
+		// Reverse within each lane then swap the lanes
+		bytes = _mm256_shuffle_epi8(bytes, _mm256_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0));
+		bytes = _mm256_permute4x64_epi64(bytes, 0x4E);
+	}
+	hi = HexCharsAvx2(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F)));
+	lo = HexCharsAvx2(_mm256_and_si256(bytes, _mm256_set1_epi8(0x0F)));
+	// Unpacking works per lane, put the halves back in order
+	first = _mm256_unpacklo_epi8(hi, lo);
+	second = _mm256_unpackhi_epi8(hi, lo);
+	_mm256_storeu_si256((__m256i*)dest, _mm256_permute2x128_si256(first, second, 0x20));
+	_mm256_storeu_si256((__m256i*)(dest + 32), _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+// 64 chars to 32 bytes, nothing is written unless all are hex
+HEX_TARGET_AVX2 static int ReadHexAvx2(unsigned char* dest, const char* source)
+{
+	int valid = 1;
+	__m256i a = HexNibblesAvx2(_mm256_loadu_si256((const __m256i*)source), &valid);
+	__m256i b = HexNibblesAvx2(_mm256_loadu_si256((const __m256i*)(source + 32)), &valid);
+	if(!valid) return 0;
+	// Packing works per lane too
+	_mm256_storeu_si256((__m256i*)dest, _mm256_permute4x64_epi64(_mm256_packus_epi16(HexPairsAvx2(a), HexPairsAvx2(b)), 0xD8));
+	return 1;
+}
+#endif
 
 unsigned short WriteBinaryToHex(char* dest, void* source, unsigned short len, unsigned char littleEndian)
 {
@@ -11,6 +173,26 @@ unsigned short WriteBinaryToHex(char* dest, void* source, unsigned short len, un
 
 	if(littleEndian) ptr += len-1; // Start at MSB
 
+#ifdef HEX_SIMD
+	// Whole blocks, little endian blocks end at ptr
+	if(HexLevel() >= HEX_LEVEL_AVX2)
+	{
+		for(;len>=32;len-=32,dest+=64)
+		{
+			if(littleEndian){ptr -= 32; WriteHexAvx2(dest, ptr+1, 1);}
+			else			{WriteHexAvx2(dest, ptr, 0); ptr += 32;}
+		}
+	}
+	if(HexLevel() >= HEX_LEVEL_SSE2)
+	{
+		for(;len>=16;len-=16,dest+=32)
+		{
+			if(littleEndian){ptr -= 16; WriteHexSse2(dest, ptr+1, 1);}
+			else			{WriteHexSse2(dest, ptr, 0); ptr += 16;}
+		}
+	}
+#endif
+
 	for(;len>0;len--)
 	{
 		temp = '0' + (*ptr >> 4);
@@ -27,11 +209,13 @@ unsigned short WriteBinaryToHex(char* dest, void* source, unsigned short len, un
 	return ret;
 }
 
-unsigned short ReadHexToBinary(unsigned char* dest, const char* source, unsigned short maxLen)
+// Up to maxLen bytes, stops at the first char that is not hex
+static unsigned short ReadHexScalar(unsigned char* dest, const char* source, unsigned short maxLen)
 {
 	unsigned short read = 0;
 
 	char hex1, hex2;
+
 	for(;maxLen>0;maxLen--)
 	{
 		// First char
@@ -61,4 +245,37 @@ unsigned short ReadHexToBinary(unsigned char* dest, const char* source, unsigned
 	return read;
 }
 
+unsigned short ReadHexToBinary(unsigned char* dest, const char* source, unsigned short maxLen)
+{
+	unsigned short read = 0, step;
+
+#ifdef HEX_SIMD
+	// Whole blocks of valid hex, the first block with anything else is left to
+	// the scalar loop. Each block is loaded before it is stored so in place is still safe.
+	// A block that could cross into the next page is read by the scalar code, which
+	// stops at a terminator, then the vector blocks carry on after the boundary.
+	if(HexLevel() >= HEX_LEVEL_SSE2)
+	{
+		while(maxLen >= 16)
+		{
+			if(HexLevel() >= HEX_LEVEL_AVX2 && maxLen >= 32 && HEX_BLOCK_READABLE(source, 64) && ReadHexAvx2(dest, source))
+				step = 32;
+			else if(!HEX_BLOCK_READABLE(source, 32))
+			{
+				step = ReadHexScalar(dest, source, 16);
+				if(step < 16) return read + step;
+			}
+			else if(ReadHexSse2(dest, source))
+				step = 16;
+			else
+				break;
+			maxLen -= step;
+			read += step;
+			dest += step;
+			source += (step * 2);
+		}
+	}
 #endif
+
+	return read + ReadHexScalar(dest, source, maxLen);
+}
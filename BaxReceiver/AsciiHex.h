@@ -3,6 +3,14 @@
 #ifndef _ASCII_HEX_H_
 #define _ASCII_HEX_H_
 
+#define HEX_LEVEL_SCALAR	0
+#define HEX_LEVEL_SSE2		1
+#define HEX_LEVEL_AVX2		2
+
+// Pick the block conversion, no faster than maxLevel - call before any threads start
+// Returns the HEX_LEVEL_x in use, the scalar code is used until this is called
+int HexSelect(int maxLevel);
+
 // Simple function to write capitalised hex to a buffer from binary
 // adds no spaces, adds a terminating null, returns chars written
 // Endianess specified, for little endian, read starts at last ptr pos backwards
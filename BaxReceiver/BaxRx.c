@@ -33,6 +33,7 @@
     #include <io.h>
 #endif
 #include <string.h>
+#include <stdlib.h>
 #include <stdint.h>
 #ifdef __C30__
 #include <Compiler.h>
@@ -61,6 +62,9 @@
 	#include "Config.h"
 	#include "BaxUtils.h"
 #endif
+#ifdef BAX_INFO_STORE
+	#include "InfoStore.h"
+#endif
 
 #ifndef NULL
 #define NULL 0
@@ -76,7 +80,7 @@ static const char* dbg_file = "baxrx";
 #include "Debug.h"
 
 // Globals
-#ifndef MAX_BAX_INFO_ENTRIES
+#if !defined(MAX_BAX_INFO_ENTRIES) && !defined(BAX_INFO_DYNAMIC)
 #ifdef _WIN32
 	#pragma message("Device will not decrypt packets!")
 #else
@@ -85,9 +89,40 @@ static const char* dbg_file = "baxrx";
 	#define MAX_BAX_INFO_ENTRIES 	0
 	#define MAX_BAX_SAVED_PACKETS 	0
 #endif
-#if (MAX_BAX_INFO_ENTRIES > 0)
+#if defined(BAX_INFO_DYNAMIC)
+typedef struct {
+	BaxDeviceInfo_t devices[BAX_INFO_SLAB_ENTRIES];
+	/* Followed by the history arena, baxHistoryDepth entries per device */
+} BaxInfoSlab_t;
+static BaxInfoSlab_t** baxInfoSlabs = NULL;							/*Device info, a slab at a time, never moved*/
+static unsigned long baxInfoSlabCount = 0;
+static unsigned long baxInfoSlots = 0;								/*Handles in the slabs*/
+static unsigned long baxInfoCount = 0;								/*Handles in use*/
+static unsigned long baxInfoFree = BAX_HANDLE_NONE;					/*Unused handles, linked through older*/
+static unsigned long baxInfoNewest = BAX_HANDLE_NONE;				/*Use order, ends of the list*/
+static unsigned long baxInfoOldest = BAX_HANDLE_NONE;
+static unsigned long baxInfoLimit = 0;								/*Devices kept, 0 for no limit*/
+static unsigned char baxInfoEvict = BAX_EVICT_LRU;					/*Which device goes at the limit*/
+static unsigned short baxHistoryDepth = MAX_BAX_SAVED_PACKETS;		/*Packets kept per device*/
+static unsigned long* baxInfoIndex = NULL;							/*Device handle + 1 by address hash, 0 if empty*/
+static unsigned long baxInfoIndexSize = 0;							/*Power of 2, over twice the devices*/
+// Handles are the slab number and position in it
+#define BAX_DEVICE(_h)			(&baxInfoSlabs[(_h) / BAX_INFO_SLAB_ENTRIES]->devices[(_h) % BAX_INFO_SLAB_ENTRIES])
+#define BAX_INDEX_SIZE			baxInfoIndexSize
+#define BAX_INDEX_DEVICE(_i)	BAX_DEVICE((_i) - 1)
+#define BAX_INDEX_VALUE(_d)		((_d)->handle + 1)
+#elif (MAX_BAX_INFO_ENTRIES > 0)
 BaxDeviceInfo_t baxDeviceInfo[MAX_BAX_INFO_ENTRIES];				/*Device info struct*/
 BaxEntry_t baxEntries[MAX_BAX_INFO_ENTRIES * MAX_BAX_SAVED_PACKETS];/*Device last packets*/
+#ifdef BAX_INFO_INDEX_SIZE
+static unsigned short baxInfoIndex[BAX_INFO_INDEX_SIZE];			/*Device info slot + 1 by address hash, 0 if empty*/
+#define BAX_INDEX_SIZE			BAX_INFO_INDEX_SIZE
+#define BAX_INDEX_DEVICE(_i)	(&baxDeviceInfo[(_i) - 1])
+#define BAX_INDEX_VALUE(_d)		((unsigned short)((_d) - baxDeviceInfo) + 1)
+#endif
+#endif
+#ifdef BAX_INDEX_SIZE
+static uint32_t baxUnknownCache[BAX_UNKNOWN_CACHE_SIZE];			/*Recent addresses with no device info*/
 #endif
 void(*BaxInfoPacketCB)(BaxPacket_t* pkt) = NULL;					/*Link packet call back*/
 
@@ -100,9 +135,39 @@ static void BaxEraseEntry(BaxEntry_t *entry);
 static void BaxEraseInfo(BaxInfo_t* info);
 static void BaxEraseDeviceInfo(BaxDeviceInfo_t* device);
 static void BaxAddNewInfo(BaxInfo_t* entry);
-static void BaxAddEntry(BaxDeviceInfo_t* device, BaxPacket_t* pkt);
+static unsigned char BaxAddEntry(BaxDeviceInfo_t* device, BaxPacket_t* pkt, DateTime time);
 static BaxDeviceInfo_t* BaxSearchInfo(unsigned long address);
+static BaxDeviceInfo_t* BaxFindInfo(unsigned long address, unsigned char remember);
+#if defined(BAX_INFO_DYNAMIC)
+static BaxDeviceInfo_t* BaxNewDevice(void);
+static void BaxFreeDevice(BaxDeviceInfo_t* device);
+static void BaxTouchDevice(BaxDeviceInfo_t* device);
+static unsigned char BaxInfoGrow(void);
+static void BaxIndexResize(unsigned long size);
+static void BaxInfoReserve(unsigned long count);
+static BaxDeviceInfo_t* BaxPlaceInfo(const BaxInfo_t* entry);
+static BaxEntry_t* BaxHistoryEntry(BaxDeviceInfo_t* device, unsigned short index);
+static unsigned char BaxSequencePkt(BaxSequence_t* sequence, unsigned char pktId, DateTime time);
+static unsigned short BaxHistorySpan(BaxDeviceInfo_t* device, unsigned short start, unsigned short count, BaxHistory_t* history);
+#endif
+#ifdef BAX_INDEX_SIZE
+static unsigned long BaxIndexFind(uint32_t address);
+static unsigned char BaxIndexAdd(BaxDeviceInfo_t* device);
+static void BaxIndexRemove(uint32_t address);
+#ifndef BAX_INFO_DYNAMIC
+static void BaxIndexRebuild(void);
+#endif
+#endif
+static void BaxExpandKey(BaxDeviceInfo_t* device);
+#ifdef AES_DEC_PREKEYED
+static void BaxKeySchedule(AesKey_t* schedule, const unsigned char* key);
+#endif
+static void BaxDecryptBlock(BaxDeviceInfo_t* device, unsigned char* data);
+static unsigned short BaxDecryptBatch(BaxPacket_t* pkts[], const DateTime* times, unsigned short count, unsigned char* decoded, unsigned char update);
 static unsigned char BaxAddInfoToFile (FSFILE* file, BaxInfo_t* info);
+#ifndef __C30__
+static unsigned char BaxLoadInfoBulk(FSFILE* file);
+#endif
 static void BaxRfConfigFromFile(FSFILE* input_file);
 void BaxChannelSurvey(FSFILE* output_file);
 
@@ -279,6 +344,7 @@ void EventCB(Si44Event_t* evt)
 void BaxPacketEvent(Si44Event_t* evt)
 {
 	unsigned short temp;
+	unsigned char decoded;
 	const unsigned short baxElementDataLen = sizeof(BaxPacket_t);
 	// Check evt->err
 	if(evt->err != SI44_OK) return;
@@ -297,7 +363,10 @@ void BaxPacketEvent(Si44Event_t* evt)
 			case DECODED_BAX_PKT_PIR : 
 			case DECODED_BAX_PKT_SW : {
 				// Try decode sensor packets
-				if(BaxDecodePkt(pkt))
+				decoded = BaxDecodePkt(pkt);
+				// Packet ids heard already go no further
+				if(decoded == BAX_PKT_DUPLICATE) break;
+				if(decoded)
 				{	
 					// Make data element for recevied and decoded packets
 					DBG_INFO("\r\nBAX SENSOR PKT");
@@ -334,33 +403,123 @@ void BaxPacketEvent(Si44Event_t* evt)
 // Decode an encrypted packet
 unsigned char BaxDecodePkt(BaxPacket_t* pkt)
 {
-	unsigned char temp[16];
+	return BaxDecodePktAt(pkt, RtcNow());
+}
+
+// Decode an encrypted packet heard at time
+unsigned char BaxDecodePktAt(BaxPacket_t* pkt, DateTime time)
+{
 	// Search for an info entry
 	BaxDeviceInfo_t* device;
 	device = BaxSearchInfo(pkt->address);
 	// Check it found one
 	if(device == NULL) return FALSE;
-	// Decrypt (requires temp buffer)
-	aes_decrypt_128(pkt->data,pkt->data,device->info.key,temp);
+	// Decrypt
+	BaxDecryptBlock(device, pkt->data);
 	// Update last packet list
-	BaxAddEntry(device, pkt);
+	if(!BaxAddEntry(device, pkt, time)) return BAX_PKT_DUPLICATE;
 	// Done
 	return TRUE;
 }
 
-// Adds the current packet to the last entries list
-static void BaxAddEntry(BaxDeviceInfo_t* device, BaxPacket_t* pkt)
+// Decrypt a packet without updating the last packet list (device table and unknown cache are only read)
+unsigned char BaxDecryptPkt(BaxPacket_t* pkt)
+{
+	// Search for an info entry
+	BaxDeviceInfo_t* device;
+	device = BaxFindInfo(pkt->address, FALSE);
+	// Check it found one
+	if(device == NULL) return FALSE;
+	// Decrypt
+	BaxDecryptBlock(device, pkt->data);
+	// Done
+	return TRUE;
+}
+
+// Decode a batch of packets, as BaxDecodePkt for each in order
+unsigned short BaxDecodePkts(BaxPacket_t* pkts[], const DateTime* times, unsigned short count, unsigned char* decoded)
+{
+	return BaxDecryptBatch(pkts, times, count, decoded, TRUE);
+}
+
+// Decrypt a batch of packets, as BaxDecryptPkt for each (device table and unknown cache are only read)
+unsigned short BaxDecryptPkts(BaxPacket_t* pkts[], unsigned short count, unsigned char* decoded)
+{
+	return BaxDecryptBatch(pkts, NULL, count, decoded, FALSE);
+}
+
+// Look up every device first then decrypt the known ones together
+static unsigned short BaxDecryptBatch(BaxPacket_t* pkts[], const DateTime* times, unsigned short count, unsigned char* decoded, unsigned char update)
+{
+	unsigned short i, found = 0;
+	DateTime now = (update && times == NULL) ? RtcNow() : 0;
+	#ifdef AES_DEC_PREKEYED
+	BaxDeviceInfo_t* devices[BAX_DECRYPT_BATCH];
+	const AesKey_t* keys[BAX_DECRYPT_BATCH];
+	unsigned char* blocks[BAX_DECRYPT_BATCH];
+	unsigned short j, n, known;
+	for(i = 0; i < count; i += n)
+	{
+		n = count - i;
+		if(n > BAX_DECRYPT_BATCH) n = BAX_DECRYPT_BATCH;
+		// Resolve the keys
+		for(j = 0, known = 0; j < n; j++)
+		{
+			devices[j] = BaxFindInfo(pkts[i + j]->address, update);
+			decoded[i + j] = (devices[j] != NULL);
+			if(devices[j] == NULL) continue;
+			keys[known] = &devices[j]->keySchedule;
+			blocks[known++] = pkts[i + j]->data;
+		}
+		// Decrypt
+		AesDecryptBlocks(keys, blocks, known);
+		found += known;
+		// Update last packet lists
+		if(!update) continue;
+		for(j = 0; j < n; j++)
+		{
+			if(devices[j] != NULL && !BaxAddEntry(devices[j], pkts[i + j], (times != NULL) ? times[i + j] : now))
+				decoded[i + j] = BAX_PKT_DUPLICATE;
+		}
+	}
+	#else
+	for(i = 0; i < count; i++)
+	{
+		decoded[i] = update ? BaxDecodePktAt(pkts[i], (times != NULL) ? times[i] : now) : BaxDecryptPkt(pkts[i]);
+		if(decoded[i]) found++;
+	}
+	#endif
+	return found;
+}
+
+// Adds the current packet heard at time to the last entries list, FALSE if its packet id was heard already
+static unsigned char BaxAddEntry(BaxDeviceInfo_t* device, BaxPacket_t* pkt, DateTime time)
 {
-	#if (MAX_BAX_SAVED_PACKETS > 0)
+	#if defined(BAX_INFO_DYNAMIC)
+	BaxEntry_t* temp;
+	BaxTouchDevice(device);
+	// Repeats are counted but not kept
+	if(!BaxSequencePkt(&device->sequence, pkt->data[BAX_FIELD_OS_pktId], time)) return FALSE;
+	// Early out for no device entries
+	if(baxHistoryDepth == 0) return TRUE;
+	// Overwrite the oldest entry in the ring
+	temp = &device->history[device->historyNext];
+	temp->time = time;
+	temp->rssi = pkt->rssi;
+	temp->pktType = pkt->pktType;
+	memcpy(temp->data,pkt->data,sizeof(BaxDataPacket_t));
+	if(++device->historyNext >= baxHistoryDepth) device->historyNext = 0;
+	if(device->historyCount < baxHistoryDepth) device->historyCount++;
+	#elif (MAX_BAX_SAVED_PACKETS > 0)
 	BaxEntry_t* temp;
 	// Early out for no device entries
-	if(MAX_BAX_SAVED_PACKETS <= 0) return;
+	if(MAX_BAX_SAVED_PACKETS <= 0) return TRUE;
 	// Get pointer to oldest in list
 	temp = device->entry[MAX_BAX_SAVED_PACKETS-1];
 	// Shift the list of *pointers* to remove last entry
 	memmove(&device->entry[1],&device->entry[0], ((MAX_BAX_SAVED_PACKETS-1) * sizeof(BaxEntry_t*)));
 	// Overwrite the older entry and set time
-	temp->time = RtcNow();
+	temp->time = time;
 	temp->rssi = pkt->rssi;
 	temp->pktType = pkt->pktType;
 	memcpy(temp->data,pkt->data,sizeof(BaxDataPacket_t));
@@ -368,7 +527,7 @@ static void BaxAddEntry(BaxDeviceInfo_t* device, BaxPacket_t* pkt)
 	device->entry[0] = temp;
 	// Done
 	#endif
-	return;
+	return TRUE;
 }
 
 // Set this to the callback fptr to enable device discovery. Call at main scope.
@@ -391,6 +550,13 @@ void BaxInfoPktDetected (BaxPacket_t* pkt)
 		// Add it to ram
 		BaxAddNewInfo(infoToSave);
 		DBG_INFO("\r\nNew bax info added.");
+		#if defined(BAX_INFO_DYNAMIC)
+		{
+			// Kept if the info file is reloaded without it
+			BaxDeviceInfo_t* device = BaxSearchInfo(tempInfo.address);
+			if(device != NULL) device->learned = TRUE;
+		}
+		#endif
 	}
 	else if (pkt->pktType == BAX_NAME_PKT)
 	{
@@ -421,7 +587,10 @@ void BaxInfoPktDetected (BaxPacket_t* pkt)
 		// Save to file too
 		infoToSave = &device->info;	
 	}
-	#ifdef BAX_DEVICE_INFO_FILE
+	#if defined(BAX_INFO_STORE)
+	// Saved with the next batch
+	InfoStoreAdd(infoToSave);
+	#elif defined(BAX_DEVICE_INFO_FILE)
 	// If we have a new info entry to save
 	if(infoToSave != NULL)
 	{
@@ -468,10 +637,24 @@ static void BaxEraseInfo(BaxInfo_t* info)
 // Erase sensor info and data, pointers left alone
 static void BaxEraseDeviceInfo(BaxDeviceInfo_t* device)
 {
+	#ifdef BAX_INDEX_SIZE
+	// Remove from the index while the address is still there
+	if(device->info.address != 0ul)
+		BaxIndexRemove(device->info.address);
+	#endif
 	// Erase device info
 	BaxEraseInfo(&device->info);
+	#ifdef AES_DEC_PREKEYED
+	memset(&device->keySchedule,0,sizeof(AesKey_t));
+	#endif
+	#if defined(BAX_INFO_DYNAMIC)
+	device->learned = FALSE;
+	// Empty the history ring and forget packet ids
+	device->historyNext = 0;
+	device->historyCount = 0;
+	memset(&device->sequence,0,sizeof(BaxSequence_t));
+	#elif (MAX_BAX_SAVED_PACKETS > 0)
 	// Invalidate device data entries
-	#if (MAX_BAX_SAVED_PACKETS > 0)
 	{
 		unsigned short i;
 		for(i=0;i<MAX_BAX_SAVED_PACKETS;i++)
@@ -482,6 +665,210 @@ static void BaxEraseDeviceInfo(BaxDeviceInfo_t* device)
 	#endif
 }
 
+#if defined(BAX_INFO_DYNAMIC)
+// Initialise the device info, slabs already made are kept for reuse
+void BaxInitDeviceInfo(void)
+{
+	unsigned long handle;
+	if(baxInfoIndex != NULL)
+		memset(baxInfoIndex,0,baxInfoIndexSize * sizeof(unsigned long));
+	memset(baxUnknownCache,0,sizeof(baxUnknownCache));
+	baxInfoCount = 0;
+	baxInfoFree = baxInfoNewest = baxInfoOldest = BAX_HANDLE_NONE;
+	// Free every handle, last first so they are used in order
+	for(handle = baxInfoSlots; handle-- > 0;)
+	{
+		BaxDeviceInfo_t* device = BAX_DEVICE(handle);
+		BaxEraseDeviceInfo(device);
+		device->newer = BAX_HANDLE_NONE;
+		device->older = baxInfoFree;
+		baxInfoFree = handle;
+	}
+}
+
+// Limit the devices kept, 0 for no limit - when full the oldest by the policy is dropped
+void BaxSetInfoLimit(unsigned long limit, unsigned char policy)
+{
+	baxInfoLimit = limit;
+	baxInfoEvict = policy;
+	while(baxInfoLimit != 0 && baxInfoCount > baxInfoLimit)
+		BaxFreeDevice(BAX_DEVICE(baxInfoOldest));
+	// With a limit the whole table and history arena are made now
+	while(baxInfoLimit != 0 && baxInfoSlots < baxInfoLimit)
+	{
+		if(!BaxInfoGrow()) break;
+	}
+}
+
+// Packets kept per device, the arena is sized when the first slab is made
+unsigned char BaxSetHistoryDepth(unsigned short depth)
+{
+	if(baxInfoSlabCount != 0) return (depth == baxHistoryDepth);
+	baxHistoryDepth = depth;
+	return TRUE;
+}
+
+// Add a slab of unused devices
+static unsigned char BaxInfoGrow(void)
+{
+	BaxInfoSlab_t **slabs, *slab;
+	unsigned long i;
+	slabs = (BaxInfoSlab_t**)realloc(baxInfoSlabs, (baxInfoSlabCount + 1) * sizeof(BaxInfoSlab_t*));
+	if(slabs == NULL) return FALSE;
+	baxInfoSlabs = slabs;
+	// The history arena is in the same block, after the devices
+	slab = (BaxInfoSlab_t*)calloc(1, sizeof(BaxInfoSlab_t) + ((size_t)BAX_INFO_SLAB_ENTRIES * baxHistoryDepth * sizeof(BaxEntry_t)));
+	if(slab == NULL) return FALSE;
+	baxInfoSlabs[baxInfoSlabCount++] = slab;
+	// Free last first so handles are used in order
+	for(i = BAX_INFO_SLAB_ENTRIES; i-- > 0;)
+	{
+		BaxDeviceInfo_t* device = &slab->devices[i];
+		device->history = (BaxEntry_t*)(slab + 1) + (i * baxHistoryDepth);
+		BaxEraseDeviceInfo(device);
+		device->handle = baxInfoSlots + i;
+		device->newer = BAX_HANDLE_NONE;
+		device->older = baxInfoFree;
+		baxInfoFree = device->handle;
+	}
+	baxInfoSlots += BAX_INFO_SLAB_ENTRIES;
+	DBG_INFO("\r\nDevice table %lu entries", baxInfoSlots);
+	return TRUE;
+}
+
+// Take a device out of the use order
+static void BaxUseUnlink(BaxDeviceInfo_t* device)
+{
+	if(device->newer != BAX_HANDLE_NONE)	BAX_DEVICE(device->newer)->older = device->older;
+	else									baxInfoNewest = device->older;
+	if(device->older != BAX_HANDLE_NONE)	BAX_DEVICE(device->older)->newer = device->newer;
+	else									baxInfoOldest = device->newer;
+	device->newer = device->older = BAX_HANDLE_NONE;
+}
+
+// Put a device at the recent end of the use order
+static void BaxUseFront(BaxDeviceInfo_t* device)
+{
+	device->newer = BAX_HANDLE_NONE;
+	device->older = baxInfoNewest;
+	if(baxInfoNewest != BAX_HANDLE_NONE)	BAX_DEVICE(baxInfoNewest)->newer = device->handle;
+	else									baxInfoOldest = device->handle;
+	baxInfoNewest = device->handle;
+}
+
+// A device was heard, least recently used eviction keeps it longest
+static void BaxTouchDevice(BaxDeviceInfo_t* device)
+{
+	if(baxInfoEvict != BAX_EVICT_LRU || baxInfoNewest == device->handle) return;
+	BaxUseUnlink(device);
+	BaxUseFront(device);
+}
+
+// An unused device, dropping the oldest if the table is at its limit (or out of memory)
+static BaxDeviceInfo_t* BaxNewDevice(void)
+{
+	BaxDeviceInfo_t* device;
+	if(baxInfoLimit != 0 && baxInfoCount >= baxInfoLimit)
+	{
+		DBG_INFO("\r\nOLD KEY REPLACED");
+		BaxFreeDevice(BAX_DEVICE(baxInfoOldest));
+	}
+	if(baxInfoFree == BAX_HANDLE_NONE && !BaxInfoGrow())
+	{
+		DBG_ERROR("Device table can not grow");
+		if(baxInfoOldest == BAX_HANDLE_NONE) return NULL;
+		BaxFreeDevice(BAX_DEVICE(baxInfoOldest));
+	}
+	device = BAX_DEVICE(baxInfoFree);
+	baxInfoFree = device->older;
+	baxInfoCount++;
+	BaxUseFront(device);
+	return device;
+}
+
+// Erase a device and return its handle
+static void BaxFreeDevice(BaxDeviceInfo_t* device)
+{
+	BaxEraseDeviceInfo(device);
+	BaxUseUnlink(device);
+	device->older = baxInfoFree;
+	baxInfoFree = device->handle;
+	baxInfoCount--;
+}
+
+// Put an info struct in the table, the key is not expanded
+static BaxDeviceInfo_t* BaxPlaceInfo(const BaxInfo_t* entry)
+{
+	BaxDeviceInfo_t* device;
+	if(entry == NULL || entry->address == 0ul) return NULL;
+
+	// Devices paired again keep their handle and place in the use order
+	device = BaxSearchInfo(entry->address);
+	if(device != NULL)
+	{
+		DBG_INFO("\r\nOLD KEY DEL.");
+		BaxEraseDeviceInfo(device);
+	}
+	else
+	{
+		device = BaxNewDevice();
+		if(device == NULL) return NULL;
+	}
+	DBG_INFO("\r\nNEW KEY ADD.");
+	memcpy(&device->info,entry,sizeof(BaxInfo_t));
+	if(!BaxIndexAdd(device))
+	{
+		// Could not be found again, so it is not kept
+		DBG_ERROR("Device index can not grow, %08lX dropped", (unsigned long)entry->address);
+		BaxFreeDevice(device);
+		return NULL;
+	}
+	BaxTouchDevice(device);
+	return device;
+}
+
+// Add a new info struct to ram
+static void BaxAddNewInfo(BaxInfo_t* entry)
+{
+	BaxDeviceInfo_t* device = BaxPlaceInfo(entry);
+	if(device != NULL) BaxExpandKey(device);
+}
+
+// Expand the key for a record, only reads global state so any thread may call it
+void BaxPrepareInfo(BaxInfoUpdate_t* update, const BaxInfo_t* info)
+{
+	memcpy(&update->info,info,sizeof(BaxInfo_t));
+	#ifdef AES_DEC_PREKEYED
+	BaxKeySchedule(&update->keySchedule,info->key);
+	#endif
+}
+
+// Apply a set of prepared changes in one go
+void BaxMergeInfo(const BaxInfoUpdate_t* updates, unsigned long count, const uint32_t* removed, unsigned long removedCount)
+{
+	BaxDeviceInfo_t* device;
+	unsigned long i;
+	// Devices taken out, unless they were paired here
+	for(i = 0; i < removedCount; i++)
+	{
+		device = BaxSearchInfo(removed[i]);
+		if(device != NULL && !device->learned)
+			BaxFreeDevice(device);
+	}
+	for(i = 0; i < count; i++)
+	{
+		// Unchanged devices keep their packet history, keys paired here are newer than the file
+		device = BaxSearchInfo(updates[i].info.address);
+		if(device != NULL && (device->learned || memcmp(&device->info,&updates[i].info,sizeof(BaxInfo_t)) == 0)) continue;
+		device = BaxPlaceInfo(&updates[i].info);
+		if(device == NULL) continue;
+		#ifdef AES_DEC_PREKEYED
+		memcpy(&device->keySchedule,&updates[i].keySchedule,sizeof(AesKey_t));
+		#endif
+	}
+}
+
+#else
 // Initialise the device info
 void BaxInitDeviceInfo(void)
 {
@@ -492,6 +879,11 @@ void BaxInitDeviceInfo(void)
 	unsigned short j = 0;
 #endif
 	
+	#ifdef BAX_INDEX_SIZE
+	// Empty index, the table is wiped below
+	memset(baxInfoIndex,0,sizeof(baxInfoIndex));
+	memset(baxUnknownCache,0,sizeof(baxUnknownCache));
+	#endif
 	// Assign pointers to entries, clear entries
 	for(i=0;i<MAX_BAX_INFO_ENTRIES;i++)
 	{
@@ -519,7 +911,17 @@ static void BaxAddNewInfo(BaxInfo_t* entry)
 	if(entry == NULL) return;	
 
 	// Erase all duplicate entries for address
-	#if (MAX_BAX_INFO_ENTRIES > 0)
+	#ifdef BAX_INDEX_SIZE
+	{
+		// The index never holds more than one
+		BaxDeviceInfo_t* device = BaxSearchInfo(address);
+		if(device != NULL)
+		{
+			DBG_INFO("\r\nOLD KEY DEL.");
+			BaxEraseDeviceInfo(device);
+		}
+	}
+	#elif (MAX_BAX_INFO_ENTRIES > 0)
 	for(i=0;i<MAX_BAX_INFO_ENTRIES;i++)
 	{
 		if(baxDeviceInfo[i].info.address == address)
@@ -538,6 +940,10 @@ static void BaxAddNewInfo(BaxInfo_t* entry)
 		{	
 			DBG_INFO("\r\nNEW KEY ADD.");
 			memcpy(&baxDeviceInfo[i].info,entry,sizeof(BaxInfo_t));
+			BaxExpandKey(&baxDeviceInfo[i]);
+			#ifdef BAX_INFO_INDEX_SIZE
+			BaxIndexAdd(&baxDeviceInfo[i]);
+			#endif
 			break;
 		}
 	}
@@ -559,15 +965,173 @@ static void BaxAddNewInfo(BaxInfo_t* entry)
 		BaxEraseDeviceInfo(&baxDeviceInfo[lastIndex]);
 		// Copy in new info structure
 		memcpy(&baxDeviceInfo[lastIndex].info,entry,sizeof(BaxInfo_t));
+		BaxExpandKey(&baxDeviceInfo[lastIndex]);
+		#ifdef BAX_INFO_INDEX_SIZE
+		// Every slot moved
+		BaxIndexRebuild();
+		#endif
 	}
 	#endif
 	return;
 }
+#endif
+
+// Expand the round keys for a device once so packets are not re-keyed every decrypt
+static void BaxExpandKey(BaxDeviceInfo_t* device)
+{
+	#ifdef AES_DEC_PREKEYED
+	BaxKeySchedule(&device->keySchedule,device->info.key);
+	#endif
+}
+
+#ifdef AES_DEC_PREKEYED
+static void BaxKeySchedule(AesKey_t* schedule, const unsigned char* key)
+{
+	unsigned char block[AES_BLOCK_SIZE], cipherKey[AES_BLOCK_SIZE];
+	// Stored keys are 'on the fly' decrypt keys (the last round key), running
+	// the key back through a decrypt gives the cipher key for the schedule
+	memset(block,0,AES_BLOCK_SIZE);
+	AesDecrypt128(block,block,key,cipherKey);
+	AesSetKey(schedule,cipherKey);
+}
+#endif
+
+// Decrypt one block in place with the device key
+static void BaxDecryptBlock(BaxDeviceInfo_t* device, unsigned char* data)
+{
+	#ifdef AES_DEC_PREKEYED
+	AesDecryptBlock(&device->keySchedule,data,data);
+	#else
+	unsigned char temp[16];
+	// Decrypt (requires temp buffer)
+	aes_decrypt_128(data,data,device->info.key,temp);
+	#endif
+}
+
+#ifdef BAX_INDEX_SIZE
+// Spread addresses over the index, sensor addresses are often sequential
+static uint32_t BaxHash(uint32_t address)
+{
+	uint32_t hash = address * 0x9E3779B1ul;
+	return hash ^ (hash >> 16);
+}
+
+// Index slot holding the address, or the empty slot ending its probe sequence
+static unsigned long BaxIndexFind(uint32_t address)
+{
+	const unsigned long mask = BAX_INDEX_SIZE - 1;
+	unsigned long pos = BaxHash(address) & mask;
+	while(baxInfoIndex[pos] != 0 && BAX_INDEX_DEVICE(baxInfoIndex[pos])->info.address != address)
+		pos = (pos + 1) & mask;
+	return pos;
+}
+
+// Returns FALSE if the index is full and could not grow, the device is not indexed
+static unsigned char BaxIndexAdd(BaxDeviceInfo_t* device)
+{
+	uint32_t address = device->info.address;
+	uint32_t* unknown = &baxUnknownCache[BaxHash(address) & (BAX_UNKNOWN_CACHE_SIZE - 1)];
+	if(address == 0ul) return TRUE;
+	#if defined(BAX_INFO_DYNAMIC)
+	// Keep the index under half full so probes stay short
+	if((baxInfoCount * 2) >= baxInfoIndexSize)
+		BaxIndexResize((baxInfoIndexSize != 0) ? (baxInfoIndexSize * 2) : BAX_INFO_INDEX_SIZE);
+	// Always leave an empty slot to end the probes
+	if(baxInfoCount >= baxInfoIndexSize) return FALSE;
+	#endif
+	baxInfoIndex[BaxIndexFind(address)] = BAX_INDEX_VALUE(device);
+	// It is not unknown any more
+	if(*unknown == address) *unknown = 0ul;
+	return TRUE;
+}
+
+// Entries after the hole move back into it unless that would put them before their hash
+static void BaxIndexRemove(uint32_t address)
+{
+	const unsigned long mask = BAX_INDEX_SIZE - 1;
+	unsigned long hole, pos, home;
+	#if defined(BAX_INFO_DYNAMIC)
+	if(baxInfoIndexSize == 0) return;
+	#endif
+	hole = BaxIndexFind(address);
+	if(baxInfoIndex[hole] == 0) return;
+	baxInfoIndex[hole] = 0;
+	for(pos = (hole + 1) & mask; baxInfoIndex[pos] != 0; pos = (pos + 1) & mask)
+	{
+		home = BaxHash(BAX_INDEX_DEVICE(baxInfoIndex[pos])->info.address) & mask;
+		if(((pos - home) & mask) >= ((pos - hole) & mask))
+		{
+			baxInfoIndex[hole] = baxInfoIndex[pos];
+			baxInfoIndex[pos] = 0;
+			hole = pos;
+		}
+	}
+}
+
+#if defined(BAX_INFO_DYNAMIC)
+// Move to a new index of size slots, left as it was if there is no memory
+static void BaxIndexResize(unsigned long size)
+{
+	unsigned long* index = (unsigned long*)calloc(size, sizeof(unsigned long));
+	unsigned long handle;
+	if(index == NULL)
+	{
+		DBG_ERROR("Device index can not grow");
+		return;
+	}
+	free(baxInfoIndex);
+	baxInfoIndex = index;
+	baxInfoIndexSize = size;
+	for(handle = 0; handle < baxInfoSlots; handle++)
+	{
+		BaxDeviceInfo_t* device = BAX_DEVICE(handle);
+		if(device->info.address != 0ul)
+			baxInfoIndex[BaxIndexFind(device->info.address)] = BAX_INDEX_VALUE(device);
+	}
+}
+
+// Size the index for count more devices up front instead of doubling as they are added
+static void BaxInfoReserve(unsigned long count)
+{
+	unsigned long size = (baxInfoIndexSize != 0) ? baxInfoIndexSize : BAX_INFO_INDEX_SIZE;
+	count += baxInfoCount;
+	if(baxInfoLimit != 0 && count > baxInfoLimit) count = baxInfoLimit;
+	while(size <= (count * 2)) size *= 2;
+	if(size > baxInfoIndexSize) BaxIndexResize(size);
+}
+#else
+static void BaxIndexRebuild(void)
+{
+	unsigned short i;
+	memset(baxInfoIndex,0,sizeof(baxInfoIndex));
+	for(i=0;i<MAX_BAX_INFO_ENTRIES;i++)
+		BaxIndexAdd(&baxDeviceInfo[i]);
+}
+#endif
+#endif
 
 // Retrieve a pointer to the info structure using current raw packet
 static BaxDeviceInfo_t* BaxSearchInfo(unsigned long address)
 {
-	#if (MAX_BAX_INFO_ENTRIES > 0)
+	return BaxFindInfo(address, TRUE);
+}
+
+// As BaxSearchInfo, misses are only added to the unknown cache if remember is set
+// (decrypt threads share the tables and must not write to them)
+static BaxDeviceInfo_t* BaxFindInfo(unsigned long address, unsigned char remember)
+{
+	#ifdef BAX_INDEX_SIZE
+	// Repeat unknown addresses are turned away without probing
+	uint32_t* unknown = &baxUnknownCache[BaxHash((uint32_t)address) & (BAX_UNKNOWN_CACHE_SIZE - 1)];
+	unsigned long pos;
+	if(address == 0ul || *unknown == (uint32_t)address) return NULL;
+	#if defined(BAX_INFO_DYNAMIC)
+	if(baxInfoIndexSize == 0) return NULL;
+	#endif
+	pos = BaxIndexFind((uint32_t)address);
+	if(baxInfoIndex[pos] != 0) return BAX_INDEX_DEVICE(baxInfoIndex[pos]);
+	if(remember) *unknown = (uint32_t)address;
+	#elif (MAX_BAX_INFO_ENTRIES > 0)
 	unsigned short i;
 	for(i=0;i<MAX_BAX_INFO_ENTRIES;i++)
 	{
@@ -593,7 +1157,13 @@ char* BaxGetName(unsigned long address)
 // Retrieve the last packet for an address if present
 BaxEntry_t* BaxGetLast(unsigned long address, unsigned short offset)
 {
-	#if (MAX_BAX_SAVED_PACKETS == 0)
+	#if defined(BAX_INFO_DYNAMIC)
+	BaxDeviceInfo_t* device;
+	device = BaxSearchInfo(address);
+	if(device == NULL || offset >= device->historyCount) return NULL;
+	// Counted back from the newest
+	return BaxHistoryEntry(device, device->historyCount - 1 - offset);
+	#elif (MAX_BAX_SAVED_PACKETS == 0)
 		return NULL;
 	#else
 	// Search for an info entry
@@ -610,6 +1180,179 @@ BaxEntry_t* BaxGetLast(unsigned long address, unsigned short offset)
 	#endif
 }
 
+#if defined(BAX_INFO_DYNAMIC)
+// History entry by age, 0 is the oldest kept
+static BaxEntry_t* BaxHistoryEntry(BaxDeviceInfo_t* device, unsigned short index)
+{
+	unsigned long pos = (unsigned long)device->historyNext + baxHistoryDepth - device->historyCount + index;
+	if(pos >= baxHistoryDepth) pos -= baxHistoryDepth;
+	return &device->history[pos];
+}
+
+// Describe count entries from the start index in place, split where the ring wraps
+static unsigned short BaxHistorySpan(BaxDeviceInfo_t* device, unsigned short start, unsigned short count, BaxHistory_t* history)
+{
+	const BaxEntry_t* first = BaxHistoryEntry(device, start);
+	unsigned short run = (unsigned short)(&device->history[baxHistoryDepth] - first);
+	if(run > count) run = count;
+	history->older = first;
+	history->olderCount = run;
+	history->newer = (count > run) ? device->history : NULL;
+	history->newerCount = count - run;
+	return count;
+}
+
+// The last count packets for an address, oldest first
+unsigned short BaxGetHistory(unsigned long address, unsigned short count, BaxHistory_t* history)
+{
+	BaxDeviceInfo_t* device;
+	memset(history,0,sizeof(BaxHistory_t));
+	device = BaxSearchInfo(address);
+	if(device == NULL) return 0;
+	if(count > device->historyCount) count = device->historyCount;
+	return BaxHistorySpan(device, device->historyCount - count, count, history);
+}
+
+// The packets for an address heard from..to inclusive, oldest first
+unsigned short BaxGetHistoryTime(unsigned long address, DateTime from, DateTime to, BaxHistory_t* history)
+{
+	BaxDeviceInfo_t* device;
+	unsigned short low, high, start, mid;
+	memset(history,0,sizeof(BaxHistory_t));
+	device = BaxSearchInfo(address);
+	if(device == NULL || from > to) return 0;
+	// Entries are in time order, find the first at or after from
+	low = 0;
+	high = device->historyCount;
+	while(low < high)
+	{
+		mid = low + ((high - low) >> 1);
+		if(BaxHistoryEntry(device, mid)->time < from)	low = mid + 1;
+		else											high = mid;
+	}
+	start = low;
+	// Then the first after to
+	high = device->historyCount;
+	while(low < high)
+	{
+		mid = low + ((high - low) >> 1);
+		if(BaxHistoryEntry(device, mid)->time <= to)	low = mid + 1;
+		else											high = mid;
+	}
+	return BaxHistorySpan(device, start, low - start, history);
+}
+
+// Count a packet id heard at time, FALSE if it is a repeat of one in the window
+static unsigned char BaxSequencePkt(BaxSequence_t* sequence, unsigned char pktId, DateTime time)
+{
+	signed char ahead;
+	unsigned char behind, run;
+	unsigned long seconds, gap;
+	// Only a packet that carries on the run keeps it
+	run = sequence->restart;
+	sequence->restart = 0;
+	// Ids can wrap round into the window over a long gap, the window starts again
+	if(RtcToSeconds(time, &seconds))
+	{
+		gap = (seconds > sequence->heard) ? (seconds - sequence->heard) : (sequence->heard - seconds);
+		if(sequence->heard != 0 && gap > BAX_SEQUENCE_GAP_SECONDS) sequence->valid = FALSE;
+		sequence->heard = seconds;
+	}
+	if(!sequence->valid)
+	{
+		sequence->valid = TRUE;
+		sequence->high = pktId;
+		sequence->window = 1;
+		sequence->received++;
+		return TRUE;
+	}
+	// Ids are 8 bit, up to 127 on is newer
+	ahead = (signed char)(unsigned char)(pktId - sequence->high);
+	if(ahead > 0)
+	{
+		// Ids jumped over are lost unless they turn up late
+		sequence->lost += ahead - 1;
+		sequence->window = (ahead < BAX_SEQUENCE_WINDOW) ? ((sequence->window << ahead) | 1) : 1;
+		sequence->high = pktId;
+	}
+	else
+	{
+		behind = (unsigned char)(sequence->high - pktId);
+		if(behind >= BAX_SEQUENCE_WINDOW)
+		{
+			// Too far back to be late, the device has started again
+			sequence->window = 1;
+			sequence->high = pktId;
+		}
+		else if(sequence->window & (1ul << behind))
+		{
+			// One of the first ids again from further on is most likely a late repeat, a run
+			// of them in order is the device restarting
+			if(pktId < BAX_SEQUENCE_RESTART_IDS && behind >= BAX_SEQUENCE_RESTART_IDS)
+			{
+				run = (run != 0 && pktId == sequence->restartNext) ? (run + 1) : 1;
+				if(run >= BAX_SEQUENCE_RESTART_RUN)
+				{
+					// The earlier ids of the run were not repeats after all
+					sequence->duplicate -= run - 1;
+					sequence->received += run;
+					sequence->window = (1ul << run) - 1;
+					sequence->high = pktId;
+					return TRUE;
+				}
+				sequence->restart = run;
+				sequence->restartNext = pktId + 1;
+			}
+			sequence->duplicate++;
+			return FALSE;
+		}
+		else
+		{
+			sequence->window |= 1ul << behind;
+			sequence->reordered++;
+			if(sequence->lost != 0) sequence->lost--;
+		}
+	}
+	sequence->received++;
+	return TRUE;
+}
+
+// Count a packet id decrypted elsewhere, unknown devices are not tracked
+unsigned char BaxTrackSequence(unsigned long address, unsigned char pktId, DateTime time)
+{
+	BaxDeviceInfo_t* device = BaxSearchInfo(address);
+	if(device == NULL) return TRUE;
+	return BaxSequencePkt(&device->sequence, pktId, time);
+}
+
+// Packet id counts for an address
+const BaxSequence_t* BaxGetSequence(unsigned long address)
+{
+	BaxDeviceInfo_t* device = BaxSearchInfo(address);
+	if(device == NULL) return NULL;
+	return &device->sequence;
+}
+
+// Address, name, received, lost, duplicate and reordered for every device heard, in table order
+void BaxSaveLinkStats(FSFILE* file)
+{
+	unsigned long handle;
+	if(file == NULL) return;
+	for(handle = 0; handle < baxInfoSlots; handle++)
+	{
+		const BaxDeviceInfo_t* device = BAX_DEVICE(handle);
+		if(device->info.address == 0ul || !device->sequence.valid) continue;
+		FSfprintf(file,"%08lX,%.*s,%lu,%lu,%lu,%lu\r\n",
+			(unsigned long)device->info.address,
+			BAX_NAME_LEN, device->info.name,
+			device->sequence.received,
+			device->sequence.lost,
+			device->sequence.duplicate,
+			device->sequence.reordered);
+	}
+}
+#endif
+
 // Load an info struct from a file pointer, read upto next entry
 unsigned char BaxLoadInfoFromFile (FSFILE* file, BaxInfo_t* read)
 {
@@ -676,7 +1419,9 @@ void BaxLoadInfoFile(char* info_file_name)
 	FSFILE* info_file;
 	// Key
 	BaxInfo_t read;
+	#ifndef BAX_INFO_DYNAMIC
 	if(MAX_BAX_INFO_ENTRIES == 0) return;
+	#endif
 	// Clear all info, initialise pointers
 	BaxEraseInfo(&read);
 	// Open file
@@ -684,6 +1429,14 @@ void BaxLoadInfoFile(char* info_file_name)
 	if(info_file)
 	{
 		DBG_INFO("\r\nLoading bax config file.");
+		#ifndef __C30__
+		// Read in one go if there is the memory
+		if(BaxLoadInfoBulk(info_file))
+		{
+			FSfclose(info_file);
+			return;
+		}
+		#endif
 		for(;;)
 		{
 			// Read new entry
@@ -704,17 +1457,64 @@ void BaxLoadInfoFile(char* info_file_name)
 	}
 }
 
+#ifndef __C30__
+// Load every whole record of an info file from one read, duplicates are added in
+// file order so the last one for an address wins - FALSE with nothing read if no memory
+static unsigned char BaxLoadInfoBulk(FSFILE* file)
+{
+	unsigned char* records;
+	BaxInfo_t read;
+	size_t count, i;
+	long size = FSFileSize(file) - FSftell(file);
+	if(size < 64) return (size >= 0);
+	records = (unsigned char*)malloc((size_t)size);
+	if(records == NULL) return FALSE;
+	count = FSfread(records, 1, (size_t)size, file) / 64;
+	#if defined(BAX_INFO_DYNAMIC)
+	BaxInfoReserve((unsigned long)count);
+	#endif
+	for(i = 0; i < count; i++)
+	{
+		memcpy(&read, &records[i * 64], sizeof(BaxInfo_t));
+		BaxAddNewInfo(&read);
+	}
+	DBG_INFO("\r\n%lu info entries loaded from file", (unsigned long)count);
+	free(records);
+	return TRUE;
+}
+#endif
+
 // Erases old info values and replaces them with current list from ram
 void BaxSaveInfoFile(void)
 {
 	#ifdef BAX_DEVICE_INFO_FILE
 	FSFILE* info_file;
 	// Save to file
+	#ifndef BAX_INFO_DYNAMIC
 	if( (MAX_BAX_INFO_ENTRIES) == 0) return;
+	#endif
 
 	info_file = FSfopen(BAX_DEVICE_INFO_FILE,"wb");
 	if(info_file)
 	{
+		#if defined(BAX_INFO_DYNAMIC)
+		unsigned long i;
+		DBG_INFO("\r\nReplacing bax config file.");
+		for (i=0;i<baxInfoSlots;i++)
+		{
+			// Unused handles are not saved
+			if(BAX_DEVICE(i)->info.address == 0ul) continue;
+			// Write to file
+			if(BaxAddInfoToFile (info_file, &BAX_DEVICE(i)->info))
+			{
+				DBG_INFO("\r\nInfo saved");
+			}
+			else
+			{
+				break;
+			}
+		}
+		#else
 		unsigned short i;
 		DBG_INFO("\r\nReplacing bax config file.");
 		for (i=0;i<MAX_BAX_INFO_ENTRIES;i++)
@@ -729,6 +1529,7 @@ void BaxSaveInfoFile(void)
 				break;
 			}
 		}
+		#endif
 		// Close file
 		FSfclose(info_file);
 	}
@@ -785,14 +1586,15 @@ unsigned char BaxFileCmd(FSFILE* input_file)
 		Si44Command(&cmd, NULL);
 
 		// Output events generated. Get line (or packet) from transport
-        // (comm_gets not defined unless SERIAL_READ_BUFFER_SIZE is set)
+        // (FramerGet not defined unless SERIAL_READ_BUFFER_SIZE is set)
 		#if !defined(__C30__) && defined(SERIAL_READ_BUFFER_SIZE)
 		{
 			// Wait up to 10ms for a response
 			unsigned long long waitUntil = MillisecondsEpoch() + 10;
 			for(;;)
 			{
-				const char*	line = comm_gets(&gSettings);
+				unsigned int len;
+				const unsigned char* line = (gSettings.framer != NULL) ? FramerGet(gSettings.framer, &gSettings, &len) : NULL;
 				if(line != NULL)
 				{
 					if(line != NULL)
@@ -801,7 +1603,7 @@ unsigned char BaxFileCmd(FSFILE* input_file)
 						DBG_INFO("\r\nCmd:");
 						DBG_DUMP(fileLineBuffer,(2 + fileLineBuffer[1]));
 
-						read = ReadHexToBinary((unsigned char*)fileLineBuffer, line, BAX_MAX_FILE_LINE_BUFFER);
+						read = ReadHexToBinary((unsigned char*)fileLineBuffer, (const char*)line, ((len / 2) < BAX_MAX_FILE_LINE_BUFFER) ? (len / 2) : BAX_MAX_FILE_LINE_BUFFER);
 						DBG_INFO("Evt:");
 						DBG_DUMP(fileLineBuffer,(3 + fileLineBuffer[2]));;
 						if(fileLineBuffer[1] != SI44_OK){DBG_INFO("-ERROR!");}
@@ -46,6 +46,10 @@
 	#include "Config.h"
 	//typedef uint32_t DateTime;
 #endif
+#include "aes.h"
+#ifdef AES_DEC_PREKEYED
+	#include "AesFast.h"
+#endif
  
 // Definitions
 #define AES_KEY_PKT_TYPE	0		/* Packet type for encryption packets */
@@ -77,6 +81,22 @@
 
 //#define MAX_BAX_INFO_ENTRIES	20 	/*Number of devices we save the keys for, 36 bytes ram each*/
 //#define MAX_BAX_SAVED_PACKETS	2	/*Number historical packets saved, 20 bytes each multiplied by max keys*/
+//#define BAX_INFO_DYNAMIC			/*Or grow the table from the heap as devices are added*/
+//#define BAX_INFO_SLAB_ENTRIES	256	/*Devices allocated at a time*/
+// Dynamic tables set the history depth at run time, MAX_BAX_SAVED_PACKETS is the default
+
+// Dynamic table handles and eviction policies
+#define BAX_HANDLE_NONE		0xFFFFFFFFul
+#define BAX_EVICT_LRU		'L'			/*Least recently heard device goes first*/
+#define BAX_EVICT_OLDEST	'O'			/*First device added goes first*/
+
+// Packet id tracking, ids behind the highest heard that are checked for repeats
+#define BAX_SEQUENCE_WINDOW	32
+#define BAX_SEQUENCE_PKT_SECONDS	1	/*Shortest time between packets from a device*/
+#define BAX_SEQUENCE_GAP_SECONDS	((256 - BAX_SEQUENCE_WINDOW) * BAX_SEQUENCE_PKT_SECONDS)	/*Longer gaps may wrap the ids into the window*/
+#define BAX_SEQUENCE_RESTART_IDS	8	/*Repeats of the first ids from further on may be a restart*/
+#define BAX_SEQUENCE_RESTART_RUN	3	/*Ids in order that show it was, the earlier ones are dropped as repeats*/
+#define BAX_PKT_DUPLICATE	2			/*BaxDecodePkt result for a packet id already heard*/
 
 // Types
 // Describes a generalised bax packet, data portion described below
@@ -140,18 +160,66 @@ typedef struct {			/*22 bytes total*/
 	unsigned char data[BAX_PKT_DATA_LEN];/*16 bytes data*/
 }BaxEntry_t; 
 
+// Link quality from the packet ids of a device
+typedef struct {
+	unsigned long received;	/*Packets decoded, not counting repeats*/
+	unsigned long lost;		/*Ids skipped and not heard since*/
+	unsigned long duplicate;/*Ids heard again, dropped*/
+	unsigned long reordered;/*Ids heard after a later one*/
+	uint32_t window;		/*Ids heard behind the highest, bit 0 is the highest*/
+	unsigned long heard;	/*Seconds since 2000 of the last id with a valid time, 0 if none*/
+	unsigned char high;		/*Highest id heard*/
+	unsigned char restart;	/*Repeats of the first ids in order so far, a possible restart*/
+	unsigned char restartNext;/*Id that carries the run on*/
+	unsigned char valid;	/*Any id heard*/
+}BaxSequence_t;
+
 // The structure holding device info
 typedef struct {
 	BaxInfo_t info;
-	#if (MAX_BAX_SAVED_PACKETS > 0)
+	#ifdef AES_DEC_PREKEYED
+	AesKey_t keySchedule;	/*Expanded from info.key when it is added*/
+	#endif
+	#if defined(BAX_INFO_DYNAMIC)
+	BaxEntry_t *history;	/*Ring of packets in the slab arena*/
+	unsigned short historyNext;/*Next entry written*/
+	unsigned short historyCount;/*Entries written, up to the depth*/
+	#elif (MAX_BAX_SAVED_PACKETS > 0)
 	BaxEntry_t *entry[MAX_BAX_SAVED_PACKETS];
 	#endif
+	#ifdef BAX_INFO_DYNAMIC
+	unsigned long handle;	/*Fixed position in the slabs*/
+	unsigned long newer;	/*Use order, or next free handle*/
+	unsigned long older;
+	unsigned char learned;	/*Paired while running rather than loaded*/
+	BaxSequence_t sequence;	/*Packet ids heard*/
+	#endif
 }BaxDeviceInfo_t;
 
+#ifdef BAX_INFO_DYNAMIC
+// A device record with its key expanded, made away from the decode thread
+typedef struct {
+	BaxInfo_t info;
+	#ifdef AES_DEC_PREKEYED
+	AesKey_t keySchedule;
+	#endif
+}BaxInfoUpdate_t;
+
+// Part of a device history in place, oldest first, in two runs where the ring wraps
+typedef struct {
+	const BaxEntry_t* older;
+	unsigned short olderCount;
+	const BaxEntry_t* newer;
+	unsigned short newerCount;
+}BaxHistory_t;
+#endif
+
 // Globals
+#ifndef BAX_INFO_DYNAMIC
 // Externed for debug only
 extern BaxDeviceInfo_t baxDeviceInfo[];
 extern BaxEntry_t baxEntries[];
+#endif
 
 // RSSI to dBm macro
 #define RssiTodBm(_c) ((signed char)-128 + ((unsigned char)_c>>1))
@@ -172,7 +240,16 @@ unsigned char BaxFileCmd(FSFILE * input_file);
 // Retrieve device info/data
 char* BaxGetName(unsigned long address);
 BaxEntry_t* BaxGetLast(unsigned long address, unsigned short offset);
+// Decrypt and update the device, TRUE if decoded (BAX_PKT_DUPLICATE if the packet id was heard already)
 unsigned char BaxDecodePkt(BaxPacket_t* pkt);
+// As BaxDecodePkt for a packet heard at time instead of now (units read back from files)
+unsigned char BaxDecodePktAt(BaxPacket_t* pkt, DateTime time);
+// Decrypt only, writes nothing so worker threads can call it together
+unsigned char BaxDecryptPkt(BaxPacket_t* pkt);
+// Batches of packets decrypted together, decoded[] is set for each packet - returns the number decoded
+// Decoded packets were heard at times[], or now if it is NULL
+unsigned short BaxDecodePkts(BaxPacket_t* pkts[], const DateTime* times, unsigned short count, unsigned char* decoded);
+unsigned short BaxDecryptPkts(BaxPacket_t* pkts[], unsigned short count, unsigned char* decoded);
 // Device discovery setter
 extern void(*BaxInfoPacketCB)(BaxPacket_t* pkt);
 void BaxSetDiscoveryCB(void(*CallBack)(BaxPacket_t* pkt));
@@ -181,6 +258,26 @@ void BaxInfoPktDetected (BaxPacket_t* pkt); /*Private*/
 void BaxAddKey(BaxInfo_t* key);
 // Initialise the info structure
 void BaxInitDeviceInfo(void);
+#ifdef BAX_INFO_DYNAMIC
+// Devices kept before one is dropped by the policy (BAX_EVICT_x), 0 for no limit
+void BaxSetInfoLimit(unsigned long limit, unsigned char policy);
+// Fill in an update record, safe on any thread
+void BaxPrepareInfo(BaxInfoUpdate_t* update, const BaxInfo_t* info);
+// Add or replace the updated devices and drop the removed ones, devices paired here are kept
+void BaxMergeInfo(const BaxInfoUpdate_t* updates, unsigned long count, const uint32_t* removed, unsigned long removedCount);
+// Packets kept per device, set before any devices are added - FALSE if the table is already made
+unsigned char BaxSetHistoryDepth(unsigned short depth);
+// The last count packets of a device, or those heard from..to inclusive - returns the number found
+// Entries are not copied and are overwritten as the device is heard again
+unsigned short BaxGetHistory(unsigned long address, unsigned short count, BaxHistory_t* history);
+unsigned short BaxGetHistoryTime(unsigned long address, DateTime from, DateTime to, BaxHistory_t* history);
+// Count a decoded packet id heard at time for packets decrypted without the table being updated, FALSE if it is a repeat
+unsigned char BaxTrackSequence(unsigned long address, unsigned char pktId, DateTime time);
+// Packet id counts for a device, NULL if it is not known
+const BaxSequence_t* BaxGetSequence(unsigned long address);
+// Write the packet id counts of every device as csv
+void BaxSaveLinkStats(FSFILE* file);
+#endif
 unsigned char BaxLoadInfoFromFile (FSFILE* file, BaxInfo_t* read);
 #endif
 //EOF
@@ -8,10 +8,14 @@
     #include <io.h>
 #else
 	#include <string.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 #include <sys/timeb.h>
@@ -19,7 +23,7 @@
 #include "Config.h"
 #include "BaxRx.h"
 #include "BaxUtils.h"
-#include "aes.h"
+#include "AesFast.h"
 
 // Debug setting
 #undef DEBUG_LEVEL
@@ -43,90 +47,117 @@ static const char* dbg_file = "util.c";
 #define SLIP_ESC_ESC 0xDD                   // Escaped sustitution for the ESC data byte
 
 #ifdef SERIAL_READ_BUFFER_SIZE
-const char* comm_gets(Settings_t* settings) 
+#define IS_HEX_CHAR(_c)	(((_c) >= '0' && (_c) <= '9') || ((_c) >= 'a' && (_c) <= 'f') || ((_c) >= 'A' && (_c) <= 'F'))
+
+// Block read shim for sources that only provide a GetByte_t
+static int readBlockFromGetc(Settings_t* settings, unsigned char* buffer, int maxLen)
 {
-	int i, input;
-	unsigned char value;
-	static unsigned int index = 0;
-	static char buffer[SERIAL_READ_BUFFER_SIZE];
+	int input;
+	if(maxLen <= 0) return 0;
+	input = settings->inGetc(settings);
+	if(input == -1) return -1;
+	*buffer = (unsigned char)input;
+	return 1;
+}
 
-	// Checks
-	if(settings->inGetc == NULL) return NULL;
+void FramerInit(Framer_t* framer, char encoding, unsigned char* buffer, unsigned int size, unsigned int length)
+{
+	framer->buffer = buffer;
+	framer->size = size;
+	framer->head = 0;
+	framer->tail = length;
+	framer->encoding = encoding;
+}
 
-	// For upto a full buffers worth
-	for(i=0;i<SERIAL_READ_BUFFER_SIZE;i++)
+unsigned char* FramerNext(Framer_t* framer, unsigned int* len)
+{
+	unsigned char *start, *end, *found;
+	for(;;)
 	{
-		// Get a char
-		input = settings->inGetc(&gSettings);
-
-		// Check there was one
-		if(input == -1) return NULL;
-
-		// Convert to unsigned char
-		value = (unsigned char)input;
+		start = &framer->buffer[framer->head];
+		end = &framer->buffer[framer->tail];
+		if(start >= end) return NULL;
 
-		// Add to line
-		buffer[index] = value;	
-		index++;
-		
-		// Check overrun - lose whole line
-		if(index >= (short)SERIAL_READ_BUFFER_SIZE)
-			index = 0;
-
-		// Check for end 
-		if(settings->encoding == 'S')
+		if(framer->encoding == 'S')
 		{
-			if(value == (unsigned char)SLIP_END)
+			found = memchr(start, SLIP_END, end - start);
+			if(found == NULL) 
 			{
-				if(index == 1) 	// Lone slip end (sync)
-				{
-					index = 0;
-					continue;
-				}
-				index = 0;		// Restart at begining
-				return buffer;
+				// Check overrun - lose whole line
+				if((end - start) >= SERIAL_READ_BUFFER_SIZE) framer->head = framer->tail;
+				return NULL;
 			}
+			framer->head = (found - framer->buffer) + 1;	// Restart after end
+			if(found == start) continue;	// Lone slip end (sync)
 		}
-		else if (settings->encoding == 'H')
+		else if (framer->encoding == 'H')
 		{
-			if(value == (unsigned char)'\r')
-			{
-				if(index == 1) 	// Lone CR
-				{
-					index = 0;
-					continue;
-				}
-				index = 0;		// Restart at begining
-				return buffer;
-			}
-			else if (	(value >= '0' && value <= '9') || 
-						(value >= 'a' && value <= 'f') ||
-						(value >= 'A' && value <= 'F') )
-			{
-				// Valid char
-			}
-			else 
+			for(found = start; found < end && IS_HEX_CHAR(*found); found++);
+			if(found >= end)
 			{
-				// Invalid char, discard
-				index = 0;
-				continue;
+				// Check overrun - lose whole line
+				if((end - start) >= SERIAL_READ_BUFFER_SIZE) framer->head = framer->tail;
+				return NULL;
 			}
+			framer->head = (found - framer->buffer) + 1;	// Restart after the terminator
+			if(*found != (unsigned char)'\r') continue;	// Invalid char, discard
+			if(found == start) continue;	// Lone CR
 		}
-		else if (settings->encoding == 'R')
+		else if (framer->encoding == 'R')
 		{
-			if(index == BINARY_DATA_UNIT_SIZE) 	// Full size segment read
-			{
-				index = 0;
-				return buffer;
-			}
+			if((end - start) < BINARY_DATA_UNIT_SIZE) return NULL;
+			framer->head += BINARY_DATA_UNIT_SIZE;	// Full size segment read
+			found = start + BINARY_DATA_UNIT_SIZE;
 		}
 		else
 		{
 			DBG_ERROR("Unknown source format");
+			framer->head = framer->tail;
+			return NULL;
 		}
+		// Frame without its terminator
+		*len = found - start;
+		return start;
+	}
+}
+
+int FramerRead(Framer_t* framer, Settings_t* settings)
+{
+	ReadBlock_t readBlock;
+	int read;
+
+	// Checks
+	if(settings->inRead != NULL) 		readBlock = settings->inRead;
+	else if(settings->inGetc != NULL) 	readBlock = readBlockFromGetc;
+	else return -1;
+
+	// Move partial frame to the start, then top up the buffer
+	if(framer->head > 0)
+	{
+		memmove(framer->buffer, &framer->buffer[framer->head], framer->tail - framer->head);
+		framer->tail -= framer->head;
+		framer->head = 0;
+	}
+	read = readBlock(settings, &framer->buffer[framer->tail], framer->size - framer->tail);
+	if(read > 0) framer->tail += read;
+	return read;
+}
+
+unsigned char* FramerGet(Framer_t* framer, Settings_t* settings, unsigned int* len)
+{
+	int i;
+	unsigned char* frame;
 
+	// For upto a full buffers worth of reads
+	for(i=0;i<SERIAL_READ_BUFFER_SIZE;i++)
+	{
+		// Return any complete frame already read
+		frame = FramerNext(framer, len);
+		if(frame != NULL) return frame;
+		// Check there was some
+		if(FramerRead(framer, settings) <= 0) return NULL;
 	}// For
-	return NULL; // Out of buffer, never gets here
+	return NULL; // Nothing complete yet
 }
 #endif
 /*
@@ -183,6 +214,79 @@ int getcFile(Settings_t* settings)
 		return -1;
 	}
 }
+// Block reader, typedef int (*ReadBlock_t)(Settings_t* settings, unsigned char* buffer, int maxLen);
+int readFile(Settings_t* settings, unsigned char* buffer, int maxLen)
+{
+	int result;
+	if(settings->inputFile == NULL) return -1;
+	if(settings->fd >= 0)
+	{
+		// Streams return what is available
+		result = read(settings->fd, buffer, maxLen);
+		if(result > 0) return result;
+		// An empty pipe is not the end of the stream
+		if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+	}
+	else
+	{
+		result = fread(buffer,sizeof(unsigned char),maxLen,settings->inputFile);
+		if(result > 0) return result;
+	}
+	// End of file or read error
+	gStatus.app_state = ERROR_STATE;
+	return -1;
+}
+// Read pipes, sockets and terminals (and stdin on windows) as streams through settings->fd, FALSE for regular files
+int streamFile(Settings_t* settings)
+{
+#ifndef _WIN32
+	struct stat st;
+#endif
+	settings->fd = -1;
+	if(settings->inputFile == NULL) return FALSE;
+#ifndef _WIN32
+	if(fstat(fileno(settings->inputFile), &st) != 0 || S_ISREG(st.st_mode)) return FALSE;
+	#ifdef F_SETPIPE_SZ
+	// Bigger pipes mean fewer, larger reads
+	if(S_ISFIFO(st.st_mode)) fcntl(fileno(settings->inputFile), F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+	#endif
+#else
+	if(settings->inputFile != stdin) return FALSE;
+#endif
+	settings->fd = fileno(settings->inputFile);
+	return TRUE;
+}
+// Map a regular input file into memory for zero copy reads, FALSE if not possible
+int mapFile(Settings_t* settings)
+{
+#ifndef _WIN32
+	struct stat st;
+	void* map;
+	if(settings->inputFile == NULL) return FALSE;
+	if(fstat(fileno(settings->inputFile), &st) != 0) return FALSE;
+	if(!S_ISREG(st.st_mode) || st.st_size <= 0) return FALSE;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(settings->inputFile), 0);
+	if(map == MAP_FAILED) return FALSE;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	settings->inputMap = (const unsigned char*)map;
+	settings->inputMapLen = st.st_size;
+	settings->inputMapPos = 0;
+	return TRUE;
+#else
+	// Not supported, stream the file instead
+	return FALSE;
+#endif
+}
+void unmapFile(Settings_t* settings)
+{
+	if(settings->inputMap == NULL) return;
+#ifndef _WIN32
+	munmap((void*)settings->inputMap, settings->inputMapLen);
+#endif
+	settings->inputMap = NULL;
+	settings->inputMapLen = 0;
+	settings->inputMapPos = 0;
+}
 // Shim for api cross compatibility to typedef int (*PutByte_t)(Settings_t* settings, unsigned char b);
 int putcFile(Settings_t* settings, unsigned char b)
 {
@@ -384,8 +488,14 @@ DateTime RtcFromString(const char *value)
 // Convert a date/time number to a string ("yyYY/MM/DD,HH:MM:SS+00" -- AT+CCLK compatible for default format)
 const char *RtcToString(DateTime value)
 {
-    // "yyYY/MM/DD,HH:MM:SS+00"
 	static char rtcString[21];
+	return RtcToStringBuffer(value, rtcString);
+}
+
+// Reentrant version, caller provides at least 21 chars
+char *RtcToStringBuffer(DateTime value, char* rtcString)
+{
+    // "yyYY/MM/DD,HH:MM:SS+00"
     char *c = rtcString;
     unsigned int v;
 	if (value < DATETIME_MIN) { *c++ = '0'; *c++ = '\0'; }				// "0"
@@ -404,6 +514,33 @@ const char *RtcToString(DateTime value)
     return rtcString;
 }
 
+// Days from 0000/03/01 to 2000/01/01, years are counted from March so the leap day is last
+#define RTC_EPOCH_DAYS	730425ul
+#define RTC_DAY_SECONDS	86400ul
+
+int RtcToSeconds(DateTime value, unsigned long* seconds)
+{
+	unsigned long year = 2000ul + DATETIME_YEAR(value), month = DATETIME_MONTH(value), days;
+	if(value < DATETIME_MIN || value > DATETIME_MAX || month < 1 || month > 12 || DATETIME_DAY(value) < 1) return FALSE;
+	if(month <= 2) year--;
+	days = (year * 365ul) + (year / 4) - (year / 100) + (year / 400);
+	days += ((153ul * ((month > 2) ? (month - 3) : (month + 9))) + 2) / 5 + DATETIME_DAY(value) - 1;
+	*seconds = ((days - RTC_EPOCH_DAYS) * RTC_DAY_SECONDS) + (DATETIME_HOURS(value) * 3600ul) + (DATETIME_MINUTES(value) * 60ul) + DATETIME_SECONDS(value);
+	return TRUE;
+}
+
+DateTime RtcFromSeconds(unsigned long seconds)
+{
+	unsigned long days = (seconds / RTC_DAY_SECONDS) + RTC_EPOCH_DAYS, daySeconds = seconds % RTC_DAY_SECONDS;
+	unsigned long era = days / 146097ul, dayOfEra = days % 146097ul, yearOfEra, dayOfYear, month, year;
+	yearOfEra = (dayOfEra - (dayOfEra / 1460) + (dayOfEra / 36524) - (dayOfEra / 146096)) / 365;
+	dayOfYear = dayOfEra - ((365 * yearOfEra) + (yearOfEra / 4) - (yearOfEra / 100));
+	month = ((5 * dayOfYear) + 2) / 153;
+	year = (era * 400) + yearOfEra + ((month >= 10) ? 1 : 0);
+	return DATETIME_FROM_YMDHMS(year, (month < 10) ? (month + 3) : (month - 9), dayOfYear - (((153 * month) + 2) / 5) + 1,
+		daySeconds / 3600, (daySeconds / 60) % 60, daySeconds % 60);
+}
+
 /*
 	UDP petitioning
 */
@@ -426,7 +563,7 @@ void UdpMakePetition(unsigned char *buffer, uint32_t time, unsigned char* destMa
 	for(i=0;i<(PETITION_BLOCK_LEN);i++)
 	{
 		// Assuming 32 byte username/pw we have 5 blocks / ~750us
-		aes_decrypt_128(temp,temp,aesKey,aesKey);
+		AesDecrypt128(temp,temp,aesKey,aesKey);
 	}
 	// Assemble the packet
 	memcpy(&buffer[UDP_OS_startToken],"<",sizeof(char));
@@ -443,7 +580,7 @@ void UdpMakePetition(unsigned char *buffer, uint32_t time, unsigned char* destMa
 	for(i=((PETITION_BLOCK_LEN-1)*N_BLOCK + 1);;)
 	{
 		// Assuming 32 byte username/pw we have 5 blocks / 750us
-		aes_encrypt_128(&buffer[i],&buffer[i],aesKey,aesKey); // +1 for'<'frame
+		AesEncrypt128(&buffer[i],&buffer[i],aesKey,aesKey); // +1 for'<'frame
 		if(i > N_BLOCK)i-=N_BLOCK;
 		else break;
 	}
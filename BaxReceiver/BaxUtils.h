@@ -53,13 +53,34 @@ typedef uint32_t DateTime;
 DateTime RtcFromString(const char *value);
 // Convert a date/time number to a string ("yyYY/MM/DD,HH:MM:SS+00" -- AT+CCLK compatible for default format)
 const char *RtcToString(DateTime value);
+char *RtcToStringBuffer(DateTime value, char* rtcString);
+// Seconds since 2000/01/01, FALSE if the value is not a date
+int RtcToSeconds(DateTime value, unsigned long* seconds);
+DateTime RtcFromSeconds(unsigned long seconds);
 // Unused
 uint32_t RtcNow(void);
 
 /*
 	Comm port operations
 */
-const char *comm_gets(Settings_t* settings);
+// Frames lines or packets out of a caller owned read buffer, one per input (settings->framer)
+// Frames are views into the buffer, valid until the next read
+#define FRAMER_BUFFER_SIZE	(SERIAL_READ_BUFFER_SIZE + SERIAL_READ_BLOCK_SIZE)
+typedef struct Framer_tag {
+	unsigned char* buffer;
+	unsigned int size;
+	unsigned int head;		/* Start of the unframed data */
+	unsigned int tail;		/* End of the read data */
+	char encoding;			/* 'H'ex lines, 'S'lip packets or 'R'aw units */
+} Framer_t;
+// Length is the data already in the buffer, 0 for an empty read buffer
+void FramerInit(Framer_t* framer, char encoding, unsigned char* buffer, unsigned int size, unsigned int length);
+// Next complete frame in the buffer without its terminator, NULL if none
+unsigned char* FramerNext(Framer_t* framer, unsigned int* len);
+// Move any partial frame to the start and read more from the input, returns the read result
+int FramerRead(Framer_t* framer, Settings_t* settings);
+// Next complete frame, reading from the input as needed
+unsigned char* FramerGet(Framer_t* framer, Settings_t* settings, unsigned int* len);
 
 /*
 	File operations
@@ -94,6 +115,12 @@ char *FSfgets(char *str, int num, FSFILE *stream);
 binUnit_t* FSfgetUnit(binUnit_t* dest, FSFILE *stream);
 // Shim for api cross compatibility to typedef int (*GetByte_t)(Settings_t* settings);
 int getcFile(Settings_t* settings);
+// Block reader, typedef int (*ReadBlock_t)(Settings_t* settings, unsigned char* buffer, int maxLen);
+int readFile(Settings_t* settings, unsigned char* buffer, int maxLen);
+int streamFile(Settings_t* settings);
+// Map a regular input file into memory for zero copy reads, FALSE if not possible
+int mapFile(Settings_t* settings);
+void unmapFile(Settings_t* settings);
 // Shim for api cross compatibility to typedef int (*PutByte_t)(Settings_t* settings, unsigned char b);
 int putcFile(Settings_t* settings, unsigned char b);
 /*
@@ -139,10 +166,14 @@ void UdpMakePetition(unsigned char *buffer, uint32_t time, unsigned char* destMa
 // Packet field offsets
 #define BAX_OFFSET_BINARY_UNIT	9
 #define BAX_OFFSET_SI44_EVENT	4
+#define BAX_OFFSET_RECEIVERS	31		/* Spare last byte, bit set for each merged input that heard the unit */
 #define BAX_FIELD_OS_address	0
 #define BAX_FIELD_OS_rssi		4
 #define BAX_FIELD_OS_pktType	5
 #define BAX_FIELD_OS_data		6
+// Pairing and name packets are applied to the device table, not read only
+#define IS_INFO_UNIT(_u) (	(_u)[BAX_OFFSET_BINARY_UNIT + BAX_FIELD_OS_pktType] == AES_KEY_PKT_TYPE || \
+							(_u)[BAX_OFFSET_BINARY_UNIT + BAX_FIELD_OS_pktType] == BAX_NAME_PKT)
 // Sensor field offsets (in pkt.data)
 #define BAX_FIELD_OS_pktId		0
 #define BAX_FIELD_OS_xmitPwrdBm	1
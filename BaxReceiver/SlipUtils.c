@@ -21,12 +21,51 @@
 	#define no_block_getc() -1
 #endif
 #include <stdio.h>
+#include <string.h>
 #include "SlipUtils.h"
 
 
 short slipIndex = 0;
 char slipBuffer[MAX_SLIP_IN_BUFFER];
 
+// Vector scan for the special bytes, SSE2 is always there on x64
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define SLIP_SSE2
+	// Frames without a length are scanned in blocks that may run past the
+	// end byte, the block is only loaded if it stays inside the page
+	#define SLIP_PAGE_SIZE		4096
+	#define SLIP_BLOCK_READABLE(_p) ((((size_t)(_p)) & (SLIP_PAGE_SIZE - 1)) <= (SLIP_PAGE_SIZE - 16))
+#endif
+
+// Returns the count of bytes before the first SLIP_END or SLIP_ESC, len if none
+static unsigned short SlipScan(const unsigned char* source, unsigned short len)
+{
+	unsigned short i = 0;
+#ifdef SLIP_SSE2
+	const __m128i end = _mm_set1_epi8((char)SLIP_END);
+	const __m128i esc = _mm_set1_epi8((char)SLIP_ESC);
+	__m128i block;
+	unsigned int mask;
+	for(; ((i + 16) <= len) && SLIP_BLOCK_READABLE(source + i); i += 16)
+	{
+		block = _mm_loadu_si128((const __m128i*)(source + i));
+		mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, end), _mm_cmpeq_epi8(block, esc)));
+		if(mask != 0)
+		{
+			// Lowest set bit is the first match
+			while(!(mask & 1)){mask >>= 1; i++;}
+			return i;
+		}
+	}
+#endif
+	for(; i < len; i++)
+	{
+		if(source[i] == (unsigned char)SLIP_END || source[i] == (unsigned char)SLIP_ESC) break;
+	}
+	return i;
+}
+
 const char *_user_getslip(void)
 {
 	int i, input;
@@ -64,88 +103,81 @@ const char *_user_getslip(void)
 	return NULL; // Out of buffer, never gets here
 }
 
-// Encode SLIP (RFC 1055) data
+// Encode SLIP (RFC 1055) data, runs without END or ESC bytes are copied whole
 unsigned short WriteToSlip(unsigned char* dest, void* source, unsigned short len, unsigned short maxLen)
 {
 	unsigned char *writeStart = dest, *readPos = (unsigned char*)source;
-    while ((len > 0) && (maxLen > 1))
-    {
-        if (*readPos == (unsigned char) SLIP_END)
-		{
-			if(maxLen < 2)break;
-			*dest++ = (unsigned char)SLIP_ESC;
-			*dest++ = (unsigned char)SLIP_ESC_END;
-			maxLen -= 2;
-		}
-        else if (*readPos == (unsigned char) SLIP_ESC)
-		{
-			if(maxLen < 2)break;
-			*dest++ = (unsigned char)SLIP_ESC;
-			*dest++ = (unsigned char)SLIP_ESC_ESC;
-			maxLen -= 2;
-		}
-        else
-		{
-			*dest++ = *readPos;
-			maxLen--;
-		}
-        readPos++;
+	unsigned short run;
+	while ((len > 0) && (maxLen > 0))
+	{
+		// Plain bytes up to the next one needing an escape
+		run = SlipScan(readPos, len);
+		if(run > maxLen) run = maxLen;
+		memcpy(dest, readPos, run);
+		dest += run;
+		readPos += run;
+		len -= run;
+		maxLen -= run;
+		if((len == 0) || (maxLen < 2)) break;
+		// Escape it
+		*dest++ = (unsigned char)SLIP_ESC;
+		*dest++ = (*readPos == (unsigned char)SLIP_END) ? (unsigned char)SLIP_ESC_END : (unsigned char)SLIP_ESC_ESC;
+		maxLen -= 2;
+		readPos++;
 		len--;
-    }
-    return dest - writeStart;
+	}
+	return dest - writeStart;
 }
 
 unsigned short ReadFromSlip(unsigned char* dest, const char* source, unsigned short maxLen)
 {
-	enum state_t 
-	{
-		STATE_ESCAPE, 
-		STATE_READ
-	} state = STATE_READ;
+	const unsigned char* readPos = (const unsigned char*)source;
+	unsigned short read = 0, run;
 
-	unsigned short read = 0;
-	unsigned char value;
+	// Lone SLIP_END at start, ignore
+	if(maxLen == 0) return 0;
+	while(*readPos == (unsigned char)SLIP_END) readPos++;
 
 	while(read < maxLen)
 	{
-		// Next binary value from read pointer
-		value = *source++;
-
-		// State part first
-		switch(state){
-			case STATE_ESCAPE: 			/* Convert to proper escaped byte*/
-					 if(value == ((unsigned char)SLIP_ESC_END)) value = SLIP_END; 	
-				else if(value == ((unsigned char)SLIP_ESC_ESC)) value = SLIP_ESC;	
-				else 
-				{
-					state = STATE_READ;	/* Unknown escaped byte, reset state(this char will be lost)*/
-					return 0;
-				} 	
-				state = STATE_READ;		/* Back to reading*/
-				break;
-			case STATE_READ :  			/* Byte checked in next switch*/
-			default : 
-				*dest = value;
-				break;									
-		} // Switch state
-				
-		// Inspect in char
-		switch (value){
-			case ((unsigned char)SLIP_ESC) : 
-				state = STATE_ESCAPE;	/* Next byte is escaped, dest* overwritted*/
-				break;
-			case ((unsigned char)SLIP_END) :
-				state = STATE_READ;		/* Un-escaped end, return line */
-				if(read > 0)			/* If at least one byte read */
-					return read;		/* Return read count now*/
-				break;					/* Lone SLIP_END at start, ignore */
-			default :					/* Increment pointer */
-				dest++;					/* Add byte to output */
-				read++;					/* Increment bytes read */
-				break;
-		}
-	} // 
+		// Copy up to the next END or ESC
+		run = SlipScan(readPos, maxLen - read);
+		memcpy(dest + read, readPos, run);
+		read += run;
+		readPos += run;
+		if(read >= maxLen) break;
+		// Un-escaped end, return line
+		if(*readPos == (unsigned char)SLIP_END) break;
+		// Convert to proper escaped byte
+		if(readPos[1] == (unsigned char)SLIP_ESC_END) 		dest[read++] = SLIP_END;
+		else if(readPos[1] == (unsigned char)SLIP_ESC_ESC) 	dest[read++] = SLIP_ESC;
+		else return 0;	/* Unknown escaped byte, the frame is lost */
+		readPos += 2;
+	}
 	// Return what we decoded
-    return read;
+	return read;
 }
 
+unsigned short SlipDecodeFrame(unsigned char* dest, const unsigned char* source, unsigned short len, unsigned short maxLen)
+{
+	unsigned short read = 0, run;
+	while(len > 0)
+	{
+		run = SlipScan(source, len);
+		// Check overrun - lose whole frame
+		if(run > (maxLen - read)) return 0;
+		memcpy(dest + read, source, run);
+		read += run;
+		source += run;
+		len -= run;
+		if(len == 0) break;
+		// Only escapes are left inside a frame
+		if((*source != (unsigned char)SLIP_ESC) || (len < 2) || (read >= maxLen)) return 0;
+		if(source[1] == (unsigned char)SLIP_ESC_END) 		dest[read++] = SLIP_END;
+		else if(source[1] == (unsigned char)SLIP_ESC_ESC) 	dest[read++] = SLIP_ESC;
+		else return 0;
+		source += 2;
+		len -= 2;
+	}
+	return read;
+}
@@ -15,6 +15,9 @@ unsigned short WriteToSlip(unsigned char* dest, void* source, unsigned short len
 // Decode slip encoded data from a buffer - returns length read
 unsigned short ReadFromSlip(unsigned char* dest, const char* source, unsigned short maxLen);
 
+// Decode one slip frame of len bytes, without its end bytes - returns length read, 0 if malformed or too long
+unsigned short SlipDecodeFrame(unsigned char* dest, const unsigned char* source, unsigned short len, unsigned short maxLen);
+
 // Debug
 #ifndef MAX_SLIP_IN_BUFFER
 #define MAX_SLIP_IN_BUFFER 1
@@ -510,7 +510,9 @@ return_type aes_set_key( const unsigned char key[], length_type keylen, aes_cont
         keylen = 24; 
         break;
     case 32:
+#if 0 /* Does not fit the 8 bit length_type */
     case 256: 
+#endif
         keylen = 32; 
         break;
     default: 
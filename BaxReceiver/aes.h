@@ -36,7 +36,7 @@
 #if 0
 #  define AES_ENC_PREKEYED  /* AES encryption with a precomputed key schedule  */
 #endif
-#if 0
+#if !defined(__C30__)
 #  define AES_DEC_PREKEYED  /* AES decryption with a precomputed key schedule  */
 #endif
 #if 1
@@ -0,0 +1,185 @@
+/*
+	Micro benchmarks
+	Times the conversion and decryption code at each level the cpu supports,
+	built and run with 'make bench'. Give section names to run only those,
+	e.g. BAXBench hex. Results are bytes (or blocks) per second of the input.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "Config.h"
+#include "BaxUtils.h"
+#include "AsciiHex.h"
+#include "AesFast.h"
+
+// Definitions
+#define BENCH_BYTES			(1024ul * 1024ul)	/* Binary data converted per pass */
+#define BENCH_MIN_SECONDS	0.5					/* Passes are repeated for at least this long */
+#define BENCH_AES_KEYS		64					/* Devices, each block is decrypted with its own key */
+
+// Globals, the library code expects the application's
+Settings_t gSettings;
+Status_t gStatus;
+
+static const char* hexLevelNames[] = {"scalar", "sse2", "avx2"};
+static const char* aesLevelNames[] = {"bytewise", "tables", "aes-ni"};
+
+// Code
+void ErrorExit(const char* fmt,...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\r\n");
+	exit(1);
+}
+
+static double BenchSeconds(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + (now.tv_nsec / 1e9);
+#endif
+}
+
+static int BenchWanted(int argc, char* argv[], const char* name)
+{
+	int i;
+	if(argc < 2) return TRUE;
+	for(i = 1; i < argc; i++)
+		if(strcmp(argv[i], name) == 0) return TRUE;
+	return FALSE;
+}
+
+static void BenchPrint(const char* what, const char* level, double units, double seconds, const char* unit)
+{
+	double rate = units / seconds;
+	if(rate >= 1e6)	printf("%-28s %-8s %10.1f M%s/s", what, level, rate / 1e6, unit);
+	else			printf("%-28s %-8s %10.1f k%s/s", what, level, rate / 1e3, unit);
+	printf("%10.1f ns/%s\r\n", (seconds * 1e9) / units, unit);
+}
+
+// Hex conversion in pieces of size bytes, as units (32) or long blocks are
+static void BenchHex(const unsigned char* data, char* hex, unsigned char* back, unsigned short size, int level)
+{
+	char what[32];
+	unsigned long pos, passes;
+	double start, seconds;
+
+	sprintf(what, "hex write %u bytes", size);
+	start = BenchSeconds();
+	for(passes = 0; (seconds = BenchSeconds() - start) < BENCH_MIN_SECONDS || passes == 0; passes++)
+		for(pos = 0; pos + size <= BENCH_BYTES; pos += size)
+			WriteBinaryToHex(hex + (pos * 2), (void*)(data + pos), size, FALSE);
+	BenchPrint(what, hexLevelNames[level], (double)passes * BENCH_BYTES, seconds, "B");
+
+	sprintf(what, "hex read %u bytes", size);
+	start = BenchSeconds();
+	for(passes = 0; (seconds = BenchSeconds() - start) < BENCH_MIN_SECONDS || passes == 0; passes++)
+		for(pos = 0; pos + size <= BENCH_BYTES; pos += size)
+			ReadHexToBinary(back + pos, hex + (pos * 2), size);
+	BenchPrint(what, hexLevelNames[level], (double)passes * BENCH_BYTES, seconds, "B");
+
+	if(memcmp(data, back, BENCH_BYTES) != 0)
+		ErrorExit("Hex %s did not read back what it wrote", hexLevelNames[level]);
+}
+
+// Decrypt one block per device, one call each and then as a batch
+static void BenchAes(unsigned char* data, int level)
+{
+	static AesKey_t keys[BENCH_AES_KEYS];
+	const AesKey_t* keyList[BENCH_AES_KEYS];
+	unsigned char* blockList[BENCH_AES_KEYS];
+	unsigned char key[N_BLOCK], check[BENCH_AES_KEYS][N_BLOCK];
+	unsigned long passes;
+	double start, seconds;
+	int i, j;
+
+	for(i = 0; i < BENCH_AES_KEYS; i++)
+	{
+		for(j = 0; j < N_BLOCK; j++)
+			key[j] = data[(i * N_BLOCK) + j];
+		AesSetKey(&keys[i], key);
+		keyList[i] = &keys[i];
+		blockList[i] = data + (BENCH_AES_KEYS * N_BLOCK) + (i * N_BLOCK);
+	}
+
+	// Both ways must give the same blocks
+	for(i = 0; i < BENCH_AES_KEYS; i++)
+		AesDecryptBlock(keyList[i], blockList[i], check[i]);
+	AesDecryptBlocks(keyList, blockList, BENCH_AES_KEYS);
+	for(i = 0; i < BENCH_AES_KEYS; i++)
+		if(memcmp(check[i], blockList[i], N_BLOCK) != 0)
+			ErrorExit("Aes %s batch does not match single blocks", aesLevelNames[level]);
+
+	start = BenchSeconds();
+	for(passes = 0; (seconds = BenchSeconds() - start) < BENCH_MIN_SECONDS || passes == 0; passes++)
+		for(i = 0; i < BENCH_AES_KEYS; i++)
+			AesDecryptBlock(keyList[i], blockList[i], blockList[i]);
+	BenchPrint("aes decrypt single", aesLevelNames[level], (double)passes * BENCH_AES_KEYS, seconds, "blk");
+
+	start = BenchSeconds();
+	for(passes = 0; (seconds = BenchSeconds() - start) < BENCH_MIN_SECONDS || passes == 0; passes++)
+		AesDecryptBlocks(keyList, blockList, BENCH_AES_KEYS);
+	BenchPrint("aes decrypt batch", aesLevelNames[level], (double)passes * BENCH_AES_KEYS, seconds, "blk");
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned char* data = (unsigned char*)malloc(BENCH_BYTES);
+	unsigned char* back = (unsigned char*)malloc(BENCH_BYTES);
+	char* hex = (char*)malloc((BENCH_BYTES * 2) + 1);
+	unsigned long i;
+	int level, top;
+
+	if(data == NULL || back == NULL || hex == NULL)
+		ErrorExit("Out of memory");
+	memset(&gSettings, 0, sizeof(gSettings));
+	memset(&gStatus, 0, sizeof(gStatus));
+	srand(1);
+	for(i = 0; i < BENCH_BYTES; i++)
+		data[i] = (unsigned char)rand();
+
+	if(BenchWanted(argc, argv, "hex"))
+	{
+		top = HexSelect(HEX_LEVEL_AVX2);
+		for(level = HEX_LEVEL_SCALAR; level <= top; level++)
+		{
+			HexSelect(level);
+			BenchHex(data, hex, back, BINARY_DATA_UNIT_SIZE, level);
+			BenchHex(data, hex, back, 4096, level);
+		}
+	}
+
+	if(BenchWanted(argc, argv, "aes"))
+	{
+		top = AesFastSelect(AES_LEVEL_NI);
+		for(level = AES_LEVEL_PORTABLE; level <= top; level++)
+		{
+			if(AesFastSelect(level) != level) continue;
+			BenchAes(data, level);
+		}
+	}
+
+	free(data);
+	free(back);
+	free(hex);
+	return 0;
+}
+
+//EOF
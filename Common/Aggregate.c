@@ -0,0 +1,254 @@
+/*
+	Aggregate output
+	Decoded sensor packets are added to per device statistics for each window
+	length instead of being written. Windows are aligned to midnight on the
+	packet timestamps and are shared by every device, so when a packet falls
+	in a later window the closed one is written for all the devices heard in
+	it, in the order they were first heard, and started again. Packets older
+	than the open window are counted in it. The open windows are written on
+	close. Devices are found by a hash of their address and their statistics
+	are kept in one array that doubles as they are added.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "Aggregate.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "aggregate";
+#endif
+#include "Debug.h"
+
+// Sensor values, in CSV column order
+#define AGGREGATE_BATT		0
+#define AGGREGATE_HUMID		1		/* Hundredths of a percent */
+#define AGGREGATE_TEMP		2		/* Tenths of a degree */
+#define AGGREGATE_LIGHT		3
+#define AGGREGATE_PIR_COUNT	4
+#define AGGREGATE_PIR_ENERGY	5
+#define AGGREGATE_FIELDS	6
+#define AGGREGATE_DAY		86400ul
+
+// Types
+typedef struct {
+	unsigned long count;			/* Packets in the open window, 0 if not heard */
+	long min[AGGREGATE_FIELDS];
+	long max[AGGREGATE_FIELDS];
+	long last[AGGREGATE_FIELDS];
+	double sum[AGGREGATE_FIELDS];
+} AggregateStats_t;
+
+typedef struct {
+	uint32_t address;
+	AggregateStats_t stats[AGGREGATE_MAX_WINDOWS];
+} AggregateDevice_t;
+
+// Prototypes
+extern void BaxUnpackSensorVals(BaxPacket_t* packet, BaxSensorPacket_t* sensor);
+
+// Globals
+static AggregateDevice_t* aggDevices = NULL;	/* In the order first heard */
+static unsigned long aggCount = 0;
+static unsigned long aggSize = 0;
+static uint32_t* aggKeys = NULL;				/* Address by hash, 0 if empty */
+static unsigned long* aggSlots = NULL;			/* Device for the key */
+static unsigned long aggKeySize = 0;
+static unsigned long aggWindow[AGGREGATE_MAX_WINDOWS];	/* Seconds */
+static unsigned long aggStart[AGGREGATE_MAX_WINDOWS];	/* Open window, seconds since 2000 */
+static unsigned char aggOpen[AGGREGATE_MAX_WINDOWS];
+static unsigned char aggWindows = 0;
+
+// Code
+static unsigned long AggregateFind(uint32_t address)
+{
+	uint32_t hash = address * 0x9E3779B1ul;
+	unsigned long pos = (hash ^ (hash >> 16)) & (aggKeySize - 1);
+	while(aggKeys[pos] != 0 && aggKeys[pos] != address)
+		pos = (pos + 1) & (aggKeySize - 1);
+	return pos;
+}
+
+// Statistics for the address, added if new - NULL if out of memory
+static AggregateDevice_t* AggregateDevice(uint32_t address)
+{
+	unsigned long pos;
+	if(aggKeySize != 0)
+	{
+		pos = AggregateFind(address);
+		if(aggKeys[pos] == address) return &aggDevices[aggSlots[pos]];
+	}
+	// Keep the index under half full
+	if((aggCount * 2) >= aggKeySize)
+	{
+		unsigned long size = (aggKeySize != 0) ? (aggKeySize * 2) : 1024, i;
+		uint32_t* keys = (uint32_t*)calloc(size, sizeof(uint32_t));
+		unsigned long* slots = (unsigned long*)malloc(size * sizeof(unsigned long));
+		if(keys == NULL || slots == NULL)
+		{
+			free(keys);
+			free(slots);
+			return NULL;
+		}
+		free(aggKeys);
+		free(aggSlots);
+		aggKeys = keys;
+		aggSlots = slots;
+		aggKeySize = size;
+		for(i = 0; i < aggCount; i++)
+		{
+			pos = AggregateFind(aggDevices[i].address);
+			aggKeys[pos] = aggDevices[i].address;
+			aggSlots[pos] = i;
+		}
+	}
+	if(aggCount >= aggSize)
+	{
+		unsigned long size = (aggSize != 0) ? (aggSize * 2) : 256;
+		AggregateDevice_t* devices = (AggregateDevice_t*)realloc(aggDevices, size * sizeof(AggregateDevice_t));
+		if(devices == NULL) return NULL;
+		aggDevices = devices;
+		aggSize = size;
+	}
+	pos = AggregateFind(address);
+	aggKeys[pos] = address;
+	aggSlots[pos] = aggCount;
+	memset(&aggDevices[aggCount], 0, sizeof(AggregateDevice_t));
+	aggDevices[aggCount].address = address;
+	return &aggDevices[aggCount++];
+}
+
+// Write one window for every device heard in it and start it again
+static void AggregateWrite(unsigned char window)
+{
+	char date[24];
+	unsigned long i;
+	unsigned char f;
+	RtcToStringBuffer(RtcFromSeconds(aggStart[window]), date);
+	for(i = 0; i < aggCount; i++)
+	{
+		AggregateStats_t* stats = &aggDevices[i].stats[window];
+		if(stats->count == 0) continue;
+		fprintf(gSettings.outputFile, "%s,%lu,%08lX,%lu", date, aggWindow[window], (unsigned long)aggDevices[i].address, stats->count);
+		for(f = 0; f < AGGREGATE_FIELDS; f++)
+		{
+			double mean = stats->sum[f] / stats->count;
+			if(f == AGGREGATE_HUMID)
+				fprintf(gSettings.outputFile, ",%ld.%02ld,%ld.%02ld,%.2f,%ld.%02ld",
+					stats->min[f] / 100, stats->min[f] % 100, stats->max[f] / 100, stats->max[f] % 100,
+					mean / 100, stats->last[f] / 100, stats->last[f] % 100);
+			else
+				fprintf(gSettings.outputFile, ",%ld,%ld,%.1f,%ld", stats->min[f], stats->max[f], mean, stats->last[f]);
+		}
+		fprintf(gSettings.outputFile, "\r\n");
+		stats->count = 0;
+	}
+}
+
+int AggregateOpen(const unsigned long* windows, unsigned char count)
+{
+	unsigned char i;
+	AggregateClose();
+	for(i = 0; i < count && aggWindows < AGGREGATE_MAX_WINDOWS; i++)
+	{
+		// Windows have to line up on each day
+		if(windows[i] == 0 || (AGGREGATE_DAY % windows[i]) != 0)
+		{
+			DBG_ERROR("Window of %lus is not a divisor of a day", windows[i]);
+			continue;
+		}
+		aggWindow[aggWindows] = windows[i];
+		aggOpen[aggWindows] = FALSE;
+		aggWindows++;
+	}
+	return (aggWindows > 0);
+}
+
+void AggregateUnit(const unsigned char* packedUnit, BaxPacket_t* pkt)
+{
+	BaxSensorPacket_t sensor;
+	AggregateDevice_t* device;
+	long values[AGGREGATE_FIELDS];
+	unsigned long seconds = 0;
+	unsigned char i, f, timed;
+
+	// Sensor packets only
+	if(pkt->pktType != DECODED_BAX_PKT && pkt->pktType != DECODED_BAX_PKT_PIR && pkt->pktType != DECODED_BAX_PKT_SW) return;
+	device = AggregateDevice(pkt->address);
+	if(device == NULL)
+	{
+		DBG_ERROR("Aggregate out of memory");
+		return;
+	}
+	BaxUnpackSensorVals(pkt, &sensor);
+	values[AGGREGATE_BATT] = sensor.battmv;
+	values[AGGREGATE_HUMID] = ((sensor.humidSat >> 8) * 100) + ((39 * (sensor.humidSat & 0xff)) / 100);
+	values[AGGREGATE_TEMP] = sensor.tempCx10;
+	values[AGGREGATE_LIGHT] = sensor.lightLux;
+	values[AGGREGATE_PIR_COUNT] = sensor.pirCounts;
+	values[AGGREGATE_PIR_ENERGY] = sensor.pirEnergy;
+
+	timed = RtcToSeconds(UnpackLE32((unsigned char*)packedUnit, 4), &seconds);
+	for(i = 0; i < aggWindows; i++)
+	{
+		AggregateStats_t* stats = &device->stats[i];
+		if(timed)
+		{
+			unsigned long start = seconds - (seconds % aggWindow[i]);
+			if(!aggOpen[i])
+			{
+				aggStart[i] = start;
+				aggOpen[i] = TRUE;
+			}
+			else if(start > aggStart[i])
+			{
+				AggregateWrite(i);
+				aggStart[i] = start;
+			}
+		}
+		// Not timed, counted in the open window if there is one
+		else if(!aggOpen[i]) continue;
+
+		for(f = 0; f < AGGREGATE_FIELDS; f++)
+		{
+			if(stats->count == 0 || values[f] < stats->min[f]) stats->min[f] = values[f];
+			if(stats->count == 0 || values[f] > stats->max[f]) stats->max[f] = values[f];
+			if(stats->count == 0) stats->sum[f] = 0;
+			stats->sum[f] += values[f];
+			stats->last[f] = values[f];
+		}
+		stats->count++;
+	}
+}
+
+void AggregateClose(void)
+{
+	unsigned char i;
+	for(i = 0; i < aggWindows; i++)
+	{
+		if(aggOpen[i] && gSettings.outputFile != NULL)
+			AggregateWrite(i);
+		aggOpen[i] = FALSE;
+	}
+	aggWindows = 0;
+	free(aggDevices);
+	free(aggKeys);
+	free(aggSlots);
+	aggDevices = NULL;
+	aggKeys = NULL;
+	aggSlots = NULL;
+	aggCount = aggSize = aggKeySize = 0;
+}
+
+//EOF
@@ -0,0 +1,18 @@
+// Aggregate output mode, per device min/max/mean/last of the sensor values over
+// fixed windows of packet time, only the aggregates are written
+#ifndef _AGGREGATE_H_
+#define _AGGREGATE_H_
+
+#include "Config.h"
+#include "BaxRx.h"
+
+// Prototypes
+// Windows in seconds (each a divisor of a day), FALSE if none are valid
+int AggregateOpen(const unsigned long* windows, unsigned char count);
+// Add a decoded unit, windows it moves past are written to the output file
+void AggregateUnit(const unsigned char* packedUnit, BaxPacket_t* pkt);
+// Write the open windows and free the devices
+void AggregateClose(void);
+
+#endif
+//EOF
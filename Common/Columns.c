@@ -0,0 +1,377 @@
+/*
+	Columnar output
+	Decoded units are added a column at a time to a block of COLUMN_BLOCK_ROWS
+	rows. Fixed size columns are kept in their file form as they are added and
+	written as they are, the timestamps (seconds since 2000, 0 if not set) are
+	delta encoded and the addresses are written as a dictionary for the block.
+	Sensor columns are 0 for units that are not sensor packets. The file is:
+
+		Header	"BAXC", u16 version, u16 columns
+		Block	u32 rows, u32 length of each column chunk, the chunks in order
+		Footer	per column: u8 name length, name, u8 value type, u8 encoding
+				u32 blocks, per block: u32 file offset (low, high), u32 rows,
+				u32 first and last time in the block
+				u32 length of the footer before this, "BAXC"
+
+	All values are little endian, so a reader can find the footer from the end
+	of the file and read only the blocks and columns it needs.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "Columns.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "columns";
+#endif
+#include "Debug.h"
+
+// Columns, in file order
+#define COLUMN_TIME			0
+#define COLUMN_ADDRESS		1
+#define COLUMN_RSSI			2
+#define COLUMN_TYPE			3
+#define COLUMN_PKT_ID		4
+#define COLUMN_XMIT_PWR		5
+#define COLUMN_BATT			6
+#define COLUMN_HUMID		7
+#define COLUMN_TEMP			8
+#define COLUMN_LIGHT		9
+#define COLUMN_PIR_COUNT	10
+#define COLUMN_PIR_ENERGY	11
+#define COLUMN_SW			12
+#define COLUMN_COUNT		13
+// Largest varint of a 32-bit value
+#define COLUMN_VARINT_MAX	5
+
+// Types
+typedef struct {
+	const char* name;
+	unsigned char type;
+	unsigned char size;			/* Bytes per value when plain */
+	unsigned char encoding;
+} ColumnInfo_t;
+
+typedef struct {
+	unsigned char offset[8];	/* File offset of the block */
+	uint32_t rows;
+	uint32_t first;				/* Time of the first and last rows */
+	uint32_t last;
+} ColumnBlock_t;
+
+// Globals
+static const ColumnInfo_t columnInfo[COLUMN_COUNT] = {
+	{"time",		COLUMN_UINT32,	4,	COLUMN_DELTA},
+	{"address",		COLUMN_UINT32,	4,	COLUMN_DICTIONARY},
+	{"rssi",		COLUMN_INT8,	1,	COLUMN_PLAIN},
+	{"type",		COLUMN_INT8,	1,	COLUMN_PLAIN},
+	{"pktId",		COLUMN_UINT8,	1,	COLUMN_PLAIN},
+	{"xmitPwrdBm",	COLUMN_INT8,	1,	COLUMN_PLAIN},
+	{"battmv",		COLUMN_UINT16,	2,	COLUMN_PLAIN},
+	{"humidSat",	COLUMN_UINT16,	2,	COLUMN_PLAIN},
+	{"tempCx10",	COLUMN_INT16,	2,	COLUMN_PLAIN},
+	{"lightLux",	COLUMN_UINT16,	2,	COLUMN_PLAIN},
+	{"pirCounts",	COLUMN_UINT16,	2,	COLUMN_PLAIN},
+	{"pirEnergy",	COLUMN_UINT16,	2,	COLUMN_PLAIN},
+	{"swCountStat",	COLUMN_UINT16,	2,	COLUMN_PLAIN}
+};
+static unsigned char* colPlain[COLUMN_COUNT];	/* Plain columns in file form */
+static uint32_t* colTime = NULL;
+static uint32_t* colAddress = NULL;
+static unsigned char* colTimeChunk = NULL;		/* Encoded when the block is written */
+static unsigned char* colAddressChunk = NULL;
+static uint32_t* colDictKeys = NULL;			/* Address by hash, 0 if empty */
+static uint32_t* colDictIndex = NULL;			/* Dictionary index of the key */
+static unsigned long colRows = 0;
+static ColumnBlock_t* colBlocks = NULL;
+static unsigned long colBlockCount = 0;
+static unsigned long colBlockSize = 0;
+static unsigned long long colOffset = 0;		/* Bytes written */
+static unsigned char colOpen = FALSE;
+
+// Prototypes
+extern void BaxUnpackSensorVals(BaxPacket_t* packet, BaxSensorPacket_t* sensor);
+
+// Code
+static void ColumnsPut(const void* data, size_t len)
+{
+	if(fwrite(data, 1, len, gSettings.outputFile) != len)
+		DBG_ERROR("Output write error");
+	colOffset += len;
+}
+
+static void ColumnsPutLE32(uint32_t value)
+{
+	unsigned char b[4];
+	b[0] = (unsigned char)value;
+	b[1] = (unsigned char)(value >> 8);
+	b[2] = (unsigned char)(value >> 16);
+	b[3] = (unsigned char)(value >> 24);
+	ColumnsPut(b, 4);
+}
+
+static void ColumnsSet16(unsigned char column, unsigned long row, unsigned short value)
+{
+	colPlain[column][row * 2] = (unsigned char)value;
+	colPlain[column][(row * 2) + 1] = (unsigned char)(value >> 8);
+}
+
+static size_t ColumnsVarint(unsigned char* out, uint32_t value)
+{
+	size_t len = 0;
+	while(value >= 0x80)
+	{
+		out[len++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	out[len++] = (unsigned char)value;
+	return len;
+}
+
+static size_t ColumnsEncodeTime(void)
+{
+	uint32_t last = 0;
+	size_t len = 0;
+	unsigned long i;
+	for(i = 0; i < colRows; i++)
+	{
+		uint32_t delta = colTime[i] - last;
+		// Zigzag so small steps back are short too
+		len += ColumnsVarint(colTimeChunk + len, (delta << 1) ^ ((delta & 0x80000000ul) ? 0xfffffffful : 0));
+		last = colTime[i];
+	}
+	return len;
+}
+
+static size_t ColumnsEncodeAddress(void)
+{
+	unsigned long size = COLUMN_BLOCK_ROWS * 2, i;
+	uint32_t count = 0, zero = 0xfffffffful;
+	unsigned char* values = colAddressChunk + 4;
+	size_t len;
+
+	// Values in the order first seen, then the indexes after them
+	memset(colDictKeys, 0, size * sizeof(uint32_t));
+	for(i = 0; i < colRows; i++)
+	{
+		uint32_t address = colAddress[i], hash = address * 0x9E3779B1ul;
+		unsigned long pos = (hash ^ (hash >> 16)) & (size - 1);
+		if(address == 0)
+		{
+			if(zero == 0xfffffffful)
+			{
+				zero = count++;
+				memset(values + (zero * 4), 0, 4);
+			}
+			colAddress[i] = zero;
+			continue;
+		}
+		while(colDictKeys[pos] != 0 && colDictKeys[pos] != address)
+			pos = (pos + 1) & (size - 1);
+		if(colDictKeys[pos] == 0)
+		{
+			colDictKeys[pos] = address;
+			colDictIndex[pos] = count;
+			values[(count * 4) + 0] = (unsigned char)address;
+			values[(count * 4) + 1] = (unsigned char)(address >> 8);
+			values[(count * 4) + 2] = (unsigned char)(address >> 16);
+			values[(count * 4) + 3] = (unsigned char)(address >> 24);
+			count++;
+		}
+		colAddress[i] = colDictIndex[pos];
+	}
+	colAddressChunk[0] = (unsigned char)count;
+	colAddressChunk[1] = (unsigned char)(count >> 8);
+	colAddressChunk[2] = (unsigned char)(count >> 16);
+	colAddressChunk[3] = (unsigned char)(count >> 24);
+	len = 4 + (count * 4);
+	for(i = 0; i < colRows; i++)
+		len += ColumnsVarint(colAddressChunk + len, colAddress[i]);
+	return len;
+}
+
+// Write the buffered rows as a block and note it for the footer
+static void ColumnsWrite(void)
+{
+	size_t timeLen, addressLen;
+	ColumnBlock_t* block;
+	unsigned char c;
+	if(colRows == 0) return;
+
+	if(colBlockCount >= colBlockSize)
+	{
+		unsigned long size = (colBlockSize != 0) ? (colBlockSize * 2) : 64;
+		ColumnBlock_t* blocks = (ColumnBlock_t*)realloc(colBlocks, size * sizeof(ColumnBlock_t));
+		if(blocks == NULL)
+		{
+			DBG_ERROR("Column index out of memory");
+			colRows = 0;
+			return;
+		}
+		colBlocks = blocks;
+		colBlockSize = size;
+	}
+	block = &colBlocks[colBlockCount++];
+	for(c = 0; c < 8; c++)
+		block->offset[c] = (unsigned char)(colOffset >> (c * 8));
+	block->rows = (uint32_t)colRows;
+	block->first = colTime[0];
+	block->last = colTime[colRows - 1];
+
+	timeLen = ColumnsEncodeTime();
+	addressLen = ColumnsEncodeAddress();
+	ColumnsPutLE32(block->rows);
+	for(c = 0; c < COLUMN_COUNT; c++)
+	{
+		if(c == COLUMN_TIME)			ColumnsPutLE32((uint32_t)timeLen);
+		else if(c == COLUMN_ADDRESS)	ColumnsPutLE32((uint32_t)addressLen);
+		else							ColumnsPutLE32((uint32_t)(colRows * columnInfo[c].size));
+	}
+	for(c = 0; c < COLUMN_COUNT; c++)
+	{
+		if(c == COLUMN_TIME)			ColumnsPut(colTimeChunk, timeLen);
+		else if(c == COLUMN_ADDRESS)	ColumnsPut(colAddressChunk, addressLen);
+		else							ColumnsPut(colPlain[c], colRows * columnInfo[c].size);
+	}
+	colRows = 0;
+}
+
+static void ColumnsFree(void)
+{
+	unsigned char c;
+	for(c = 0; c < COLUMN_COUNT; c++)
+	{
+		free(colPlain[c]);
+		colPlain[c] = NULL;
+	}
+	free(colTime);
+	free(colAddress);
+	free(colTimeChunk);
+	free(colAddressChunk);
+	free(colDictKeys);
+	free(colDictIndex);
+	free(colBlocks);
+	colTime = colAddress = colDictKeys = colDictIndex = NULL;
+	colTimeChunk = colAddressChunk = NULL;
+	colBlocks = NULL;
+	colBlockCount = colBlockSize = 0;
+	colRows = 0;
+}
+
+int ColumnsOpen(void)
+{
+	unsigned char c, header[8];
+	if(colOpen) return TRUE;
+	memset(colPlain, 0, sizeof(colPlain));
+	for(c = 0; c < COLUMN_COUNT; c++)
+	{
+		if(columnInfo[c].encoding != COLUMN_PLAIN) continue;
+		colPlain[c] = (unsigned char*)malloc(COLUMN_BLOCK_ROWS * columnInfo[c].size);
+		if(colPlain[c] == NULL) break;
+	}
+	colTime = (uint32_t*)malloc(COLUMN_BLOCK_ROWS * sizeof(uint32_t));
+	colAddress = (uint32_t*)malloc(COLUMN_BLOCK_ROWS * sizeof(uint32_t));
+	colTimeChunk = (unsigned char*)malloc(COLUMN_BLOCK_ROWS * COLUMN_VARINT_MAX);
+	colAddressChunk = (unsigned char*)malloc(4 + (COLUMN_BLOCK_ROWS * (4 + COLUMN_VARINT_MAX)));
+	colDictKeys = (uint32_t*)malloc(COLUMN_BLOCK_ROWS * 2 * sizeof(uint32_t));
+	colDictIndex = (uint32_t*)malloc(COLUMN_BLOCK_ROWS * 2 * sizeof(uint32_t));
+	if(c < COLUMN_COUNT || colTime == NULL || colAddress == NULL || colTimeChunk == NULL ||
+		colAddressChunk == NULL || colDictKeys == NULL || colDictIndex == NULL)
+	{
+		ColumnsFree();
+		return FALSE;
+	}
+
+	colOffset = 0;
+	memcpy(header, COLUMNS_MAGIC, 4);
+	header[4] = (unsigned char)COLUMNS_VERSION;
+	header[5] = (unsigned char)(COLUMNS_VERSION >> 8);
+	header[6] = (unsigned char)COLUMN_COUNT;
+	header[7] = 0;
+	ColumnsPut(header, sizeof(header));
+	colOpen = TRUE;
+	return TRUE;
+}
+
+void ColumnsUnit(const unsigned char* packedUnit, BaxPacket_t* pkt)
+{
+	BaxSensorPacket_t sensor;
+	unsigned long seconds;
+	unsigned long row = colRows;
+	if(!colOpen) return;
+
+	if(!RtcToSeconds(UnpackLE32((unsigned char*)packedUnit, 4), &seconds))
+		seconds = 0;
+	colTime[row] = (uint32_t)seconds;
+	colAddress[row] = pkt->address;
+	colPlain[COLUMN_RSSI][row] = (unsigned char)RssiTodBm(pkt->rssi);
+	colPlain[COLUMN_TYPE][row] = (unsigned char)pkt->pktType;
+
+	// Sensor values, 0 for other packets
+	if(pkt->pktType == DECODED_BAX_PKT || pkt->pktType == DECODED_BAX_PKT_PIR || pkt->pktType == DECODED_BAX_PKT_SW)
+		BaxUnpackSensorVals(pkt, &sensor);
+	else
+		memset(&sensor, 0, sizeof(sensor));
+	colPlain[COLUMN_PKT_ID][row] = sensor.pktId;
+	colPlain[COLUMN_XMIT_PWR][row] = (unsigned char)sensor.xmitPwrdBm;
+	ColumnsSet16(COLUMN_BATT, row, sensor.battmv);
+	ColumnsSet16(COLUMN_HUMID, row, sensor.humidSat);
+	ColumnsSet16(COLUMN_TEMP, row, (unsigned short)sensor.tempCx10);
+	ColumnsSet16(COLUMN_LIGHT, row, sensor.lightLux);
+	ColumnsSet16(COLUMN_PIR_COUNT, row, sensor.pirCounts);
+	ColumnsSet16(COLUMN_PIR_ENERGY, row, sensor.pirEnergy);
+	ColumnsSet16(COLUMN_SW, row, sensor.swCountStat);
+
+	if(++colRows >= COLUMN_BLOCK_ROWS)
+		ColumnsWrite();
+}
+
+void ColumnsClose(void)
+{
+	unsigned long long start;
+	unsigned long i;
+	unsigned char c;
+	if(!colOpen) return;
+	colOpen = FALSE;
+	if(gSettings.outputFile != NULL)
+	{
+		ColumnsWrite();
+		// Column descriptions then the block index
+		start = colOffset;
+		for(c = 0; c < COLUMN_COUNT; c++)
+		{
+			unsigned char info[2];
+			unsigned char len = (unsigned char)strlen(columnInfo[c].name);
+			ColumnsPut(&len, 1);
+			ColumnsPut(columnInfo[c].name, len);
+			info[0] = columnInfo[c].type;
+			info[1] = columnInfo[c].encoding;
+			ColumnsPut(info, 2);
+		}
+		ColumnsPutLE32((uint32_t)colBlockCount);
+		for(i = 0; i < colBlockCount; i++)
+		{
+			ColumnsPut(colBlocks[i].offset, 8);
+			ColumnsPutLE32(colBlocks[i].rows);
+			ColumnsPutLE32(colBlocks[i].first);
+			ColumnsPutLE32(colBlocks[i].last);
+		}
+		ColumnsPutLE32((uint32_t)(colOffset - start));
+		ColumnsPut(COLUMNS_MAGIC, 4);
+	}
+	ColumnsFree();
+}
+
+//EOF
@@ -0,0 +1,32 @@
+// Columnar output mode, decoded units are written in blocks of column chunks
+// with an index of the blocks in the footer of the file
+#ifndef _COLUMNS_H_
+#define _COLUMNS_H_
+
+#include "Config.h"
+#include "BaxRx.h"
+
+// Definitions
+#define COLUMNS_MAGIC		"BAXC"	/* Starts and ends the file */
+#define COLUMNS_VERSION		1
+// Value types
+#define COLUMN_UINT8		1
+#define COLUMN_INT8			2
+#define COLUMN_UINT16		3
+#define COLUMN_INT16		4
+#define COLUMN_UINT32		5
+// Chunk encodings
+#define COLUMN_PLAIN		0		/* Little endian values */
+#define COLUMN_DELTA		1		/* Zigzag varint difference from the value before (from 0 for the first) */
+#define COLUMN_DICTIONARY	2		/* Value count, the values, then a varint index into them per row */
+
+// Prototypes
+// Write the file header and make the first block, FALSE if out of memory
+int ColumnsOpen(void);
+// Add a unit that passed the filter, full blocks are written to the output file
+void ColumnsUnit(const unsigned char* packedUnit, BaxPacket_t* pkt);
+// Write the last block and the footer
+void ColumnsClose(void);
+
+#endif
+//EOF
@@ -0,0 +1,170 @@
+/*
+	Receiver duplicates
+	Every receiver in range of a sensor forwards its own unit for the same
+	transmission. The copies have the same address, type and encrypted
+	payload (the packet id is inside it) and differ only in their rssi and
+	receiver timestamps. The first copy is held for the window and later
+	copies only raise its rssi and add their receiver bit, so one unit per
+	transmission is passed on with the strongest signal. Held units are in a
+	ring in arrival order with a chained hash over it, so adding, finding and
+	expiring the oldest are constant time and the memory is fixed. If the ring
+	is full the oldest unit is passed on early.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "Dedupe.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "dedupe";
+#endif
+#include "Debug.h"
+
+// End of a bucket chain
+#define DEDUPE_NONE		0xfffffffful
+
+// Types
+typedef struct {
+	unsigned char unit[BINARY_DATA_UNIT_SIZE];	/* Strongest copy so far */
+	unsigned long long time;					/* Arrival of the first copy (ms) */
+	uint32_t hash;
+	unsigned long next;							/* Next held unit in the bucket */
+} DedupeSlot_t;
+
+// Globals
+static DedupeSlot_t* dedupeSlots = NULL;		/* Ring of held units, oldest at dedupeHead */
+static unsigned long* dedupeBuckets = NULL;	/* First slot for the hash, DEDUPE_NONE if empty */
+static unsigned long dedupeHead = 0;
+static unsigned long dedupeCount = 0;
+static unsigned long long dedupeWindow = 0;
+static unsigned long dedupeMerged = 0;
+
+// Code
+// Address, type and encrypted payload, everything but the rssi
+static uint32_t DedupeHash(const unsigned char* pkt)
+{
+	uint32_t hash = UnpackLE32((unsigned char*)pkt, BAX_FIELD_OS_address) * 0x9E3779B1ul;
+	unsigned char i;
+	for(i = BAX_FIELD_OS_pktType; i + 4 <= BAX_PACKET_SIZE; i += 4)
+		hash = (hash ^ UnpackLE32((unsigned char*)pkt, i)) * 0x9E3779B1ul;
+	hash = (hash ^ pkt[BAX_PACKET_SIZE - 1]) * 0x9E3779B1ul;
+	return hash ^ (hash >> 16);
+}
+
+static int DedupeSame(const unsigned char* a, const unsigned char* b)
+{
+	return memcmp(a + BAX_FIELD_OS_address, b + BAX_FIELD_OS_address, 4) == 0 &&
+		memcmp(a + BAX_FIELD_OS_pktType, b + BAX_FIELD_OS_pktType, BAX_PACKET_SIZE - BAX_FIELD_OS_pktType) == 0;
+}
+
+// Take the oldest unit out of the ring and pass it on
+static int DedupePop(int (*handler)(unsigned char* unit))
+{
+	DedupeSlot_t* slot = &dedupeSlots[dedupeHead];
+	unsigned long* link = &dedupeBuckets[slot->hash & (SOURCE_DEDUPE_UNITS - 1)];
+	// The oldest unit is the last in its chain
+	while(*link != dedupeHead)
+		link = &dedupeSlots[*link].next;
+	*link = slot->next;
+	dedupeHead = (dedupeHead + 1) & (SOURCE_DEDUPE_UNITS - 1);
+	dedupeCount--;
+	handler(slot->unit);
+	return 1;
+}
+
+int DedupeOpen(unsigned short windowMs)
+{
+	unsigned long i;
+	DedupeClose();
+	dedupeSlots = (DedupeSlot_t*)malloc(SOURCE_DEDUPE_UNITS * sizeof(DedupeSlot_t));
+	dedupeBuckets = (unsigned long*)malloc(SOURCE_DEDUPE_UNITS * sizeof(unsigned long));
+	if(dedupeSlots == NULL || dedupeBuckets == NULL)
+	{
+		DBG_ERROR("No memory for %lu held units", (unsigned long)SOURCE_DEDUPE_UNITS);
+		DedupeClose();
+		return FALSE;
+	}
+	for(i = 0; i < SOURCE_DEDUPE_UNITS; i++)
+		dedupeBuckets[i] = DEDUPE_NONE;
+	dedupeWindow = windowMs;
+	DBG_INFO("\r\nReceiver copies merged over %u ms", windowMs);
+	return TRUE;
+}
+
+int DedupeAdd(const unsigned char* unit, unsigned long long now, int (*handler)(unsigned char* unit))
+{
+	const unsigned char* pkt = unit + BAX_OFFSET_BINARY_UNIT;
+	uint32_t hash = DedupeHash(pkt);
+	unsigned long* bucket = &dedupeBuckets[hash & (SOURCE_DEDUPE_UNITS - 1)];
+	unsigned long pos;
+	int count = 0;
+
+	// Another copy of a held unit
+	for(pos = *bucket; pos != DEDUPE_NONE; pos = dedupeSlots[pos].next)
+	{
+		DedupeSlot_t* slot = &dedupeSlots[pos];
+		unsigned char* held = slot->unit + BAX_OFFSET_BINARY_UNIT;
+		if(slot->hash != hash || !DedupeSame(held, pkt)) continue;
+		if(pkt[BAX_FIELD_OS_rssi] > held[BAX_FIELD_OS_rssi])
+		{
+			unsigned char receivers = slot->unit[BAX_OFFSET_RECEIVERS];
+			memcpy(slot->unit, unit, BINARY_DATA_UNIT_SIZE);
+			slot->unit[BAX_OFFSET_RECEIVERS] |= receivers;
+		}
+		else
+		{
+			slot->unit[BAX_OFFSET_RECEIVERS] |= unit[BAX_OFFSET_RECEIVERS];
+		}
+		dedupeMerged++;
+		return 0;
+	}
+
+	// A new transmission, the oldest goes early if there is no room
+	if(dedupeCount >= SOURCE_DEDUPE_UNITS)
+		count += DedupePop(handler);
+	pos = (dedupeHead + dedupeCount++) & (SOURCE_DEDUPE_UNITS - 1);
+	memcpy(dedupeSlots[pos].unit, unit, BINARY_DATA_UNIT_SIZE);
+	dedupeSlots[pos].time = now;
+	dedupeSlots[pos].hash = hash;
+	dedupeSlots[pos].next = *bucket;
+	*bucket = pos;
+	return count;
+}
+
+int DedupeExpire(unsigned long long now, int (*handler)(unsigned char* unit))
+{
+	int count = 0;
+	// Units are held in arrival order so only the oldest needs checking
+	while(dedupeCount > 0)
+	{
+		if(now != 0 && (now - dedupeSlots[dedupeHead].time) < dedupeWindow) break;
+		count += DedupePop(handler);
+	}
+	return count;
+}
+
+void DedupeClose(void)
+{
+	if(dedupeSlots != NULL)
+		DBG_INFO("\r\n%lu receiver copies merged", dedupeMerged);
+	free(dedupeSlots);
+	free(dedupeBuckets);
+	dedupeSlots = NULL;
+	dedupeBuckets = NULL;
+	dedupeHead = dedupeCount = 0;
+	dedupeMerged = 0;
+}
+
+//EOF
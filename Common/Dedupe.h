@@ -0,0 +1,19 @@
+// Copies of one transmission heard by several receivers, the strongest copy is
+// kept and the receivers that heard it are set in the unit's spare byte
+#ifndef _DEDUPE_H_
+#define _DEDUPE_H_
+
+#include "Config.h"
+
+// Prototypes
+// Hold units for windowMs after their first copy, FALSE if out of memory
+int DedupeOpen(unsigned short windowMs);
+// Hold a unit or merge it with a held copy, returns the number of units passed to the handler to make room
+int DedupeAdd(const unsigned char* unit, unsigned long long now, int (*handler)(unsigned char* unit));
+// Pass on units whose window has ended (all of them if now is 0), returns the number passed to the handler
+int DedupeExpire(unsigned long long now, int (*handler)(unsigned char* unit));
+// Free the window, held units are lost
+void DedupeClose(void);
+
+#endif
+//EOF
@@ -0,0 +1,183 @@
+/*
+	Unit filter
+	Units are checked on their packed header before they are unpacked or
+	decrypted. A unit is dropped if its address is on the deny list, or not
+	on the allow list when there is one, or if its type could not pass the
+	packet filter whether or not it decrypts. The lists are text files of
+	addresses in hex as written in the CSV output, one per line, and are
+	kept as hash sets. They are only read once loaded.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "Filter.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "filter";
+#endif
+#include "Debug.h"
+
+// Types
+typedef struct {
+	uint32_t* keys;				/* Address by hash, 0 if empty */
+	unsigned long size;			/* Power of 2, 0 if there is no list */
+	unsigned long count;
+} FilterSet_t;
+
+// Globals
+static FilterSet_t filterAllow;
+static FilterSet_t filterDeny;
+
+// Code
+static unsigned long FilterFind(const FilterSet_t* set, uint32_t address)
+{
+	uint32_t hash = address * 0x9E3779B1ul;
+	unsigned long pos = (hash ^ (hash >> 16)) & (set->size - 1);
+	while(set->keys[pos] != 0 && set->keys[pos] != address)
+		pos = (pos + 1) & (set->size - 1);
+	return pos;
+}
+
+// Address 0 marks empty slots, it is never in a list
+static int FilterHas(const FilterSet_t* set, uint32_t address)
+{
+	if(address == 0ul) return FALSE;
+	return set->keys[FilterFind(set, address)] == address;
+}
+
+static int FilterGrow(FilterSet_t* set)
+{
+	FilterSet_t grown;
+	unsigned long i;
+	grown.size = (set->size != 0) ? (set->size * 2) : 256;
+	grown.count = set->count;
+	grown.keys = (uint32_t*)calloc(grown.size, sizeof(uint32_t));
+	if(grown.keys == NULL) return FALSE;
+	for(i = 0; i < set->size; i++)
+	{
+		if(set->keys[i] != 0)
+			grown.keys[FilterFind(&grown, set->keys[i])] = set->keys[i];
+	}
+	free(set->keys);
+	*set = grown;
+	return TRUE;
+}
+
+static int FilterAdd(FilterSet_t* set, uint32_t address)
+{
+	unsigned long pos;
+	if(address == 0ul) return TRUE;
+	// Keep under half full
+	if((set->count * 2) >= set->size && !FilterGrow(set)) return FALSE;
+	pos = FilterFind(set, address);
+	if(set->keys[pos] == address) return TRUE;
+	set->keys[pos] = address;
+	set->count++;
+	return TRUE;
+}
+
+// Read a list of hex addresses, blank lines and '#' comments are skipped
+static int FilterLoad(FilterSet_t* set, const char* fileName)
+{
+	char line[128];
+	FILE* file = fopen(fileName, "r");
+	if(file == NULL) return FALSE;
+	// An empty allow list still allows nothing
+	if(set->size == 0 && !FilterGrow(set))
+	{
+		fclose(file);
+		return FALSE;
+	}
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		char* end;
+		unsigned long address = strtoul(line, &end, 16);
+		if(end == line) continue;
+		if(!FilterAdd(set, (uint32_t)address))
+		{
+			fclose(file);
+			return FALSE;
+		}
+	}
+	fclose(file);
+	DBG_INFO("\r\n%lu addresses in %s", set->count, fileName);
+	return TRUE;
+}
+
+// TRUE if a packet of this type would be output or added to the device table
+static int FilterType(unsigned char pktType)
+{
+	switch(pktType){
+		case (unsigned char)AES_KEY_PKT_TYPE :
+			return (gSettings.filter & FILTER_FLAG_PAIRING) || (gSettings.linkMode & LINK_FLAG_ADD);
+		case (unsigned char)BAX_NAME_PKT :
+			return (gSettings.filter & FILTER_FLAG_NAME) || (gSettings.linkMode & LINK_FLAG_ADD);
+		case (unsigned char)DECODED_BAX_PKT :
+		case (unsigned char)DECODED_BAX_PKT_PIR :
+		case (unsigned char)DECODED_BAX_PKT_SW :
+			return (gSettings.filter & FILTER_FLAG_DECODED);
+		case (unsigned char)PACKET_TYPE_RAW_UINT8_x14 :
+		case (unsigned char)PACKET_TYPE_RAW_SINT8_x14 :
+		case (unsigned char)PACKET_TYPE_RAW_UINT16_x7 :
+		case (unsigned char)PACKET_TYPE_RAW_SINT16_x7 :
+			return (gSettings.filter & FILTER_FLAG_RAW);
+		default :
+			return (gSettings.filter & FILTER_FLAG_ENCRYPTED);
+	}
+}
+
+int FilterOpen(const char* allowFile, const char* denyFile)
+{
+	FilterClose();
+	if(allowFile != NULL && !FilterLoad(&filterAllow, allowFile))
+	{
+		DBG_ERROR("Can not read %s", allowFile);
+		FilterClose();
+		return FALSE;
+	}
+	if(denyFile != NULL && !FilterLoad(&filterDeny, denyFile))
+	{
+		DBG_ERROR("Can not read %s", denyFile);
+		FilterClose();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int FilterUnit(const unsigned char* packedUnit)
+{
+	const unsigned char* header = packedUnit + BAX_OFFSET_BINARY_UNIT;
+	unsigned char pktType = header[BAX_FIELD_OS_pktType];
+	if(filterAllow.size != 0 || filterDeny.size != 0)
+	{
+		uint32_t address = UnpackLE32((unsigned char*)header, BAX_FIELD_OS_address);
+		if(filterDeny.size != 0 && FilterHas(&filterDeny, address)) return FALSE;
+		if(filterAllow.size != 0 && !FilterHas(&filterAllow, address)) return FALSE;
+	}
+	// Encrypted packets keep their type if they do not decrypt
+	if(pktType > (unsigned char)ENCRYPTED_PKT_TYPE_OFFSET)
+		return (gSettings.filter & FILTER_FLAG_ENCRYPTED) || FilterType((unsigned char)-pktType);
+	return FilterType(pktType);
+}
+
+void FilterClose(void)
+{
+	free(filterAllow.keys);
+	free(filterDeny.keys);
+	memset(&filterAllow, 0, sizeof(FilterSet_t));
+	memset(&filterDeny, 0, sizeof(FilterSet_t));
+}
+
+//EOF
@@ -0,0 +1,16 @@
+// Unit filter, checked on the packed header before anything is decrypted
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include "Config.h"
+
+// Prototypes
+// Load the allowed and denied address lists (either may be NULL), FALSE if a list can not be read
+int FilterOpen(const char* allowFile, const char* denyFile);
+// TRUE if the unit could pass the packet filter and is worth decrypting, read only so safe on worker threads
+int FilterUnit(const unsigned char* packedUnit);
+// Free the lists
+void FilterClose(void);
+
+#endif
+//EOF
@@ -0,0 +1,365 @@
+/*
+	Device info file writer
+	Pairing and name packets queue their records here instead of opening the
+	file for each one. A thread appends the queue in one write every
+	INFO_STORE_POLL_MS and keeps count of the addresses in the file. When too
+	many records are out of date the file is rewritten with one record per
+	address (its last record, in the order the last records were written) to a
+	temporary file that is renamed over the original, so the file is never left
+	part written. Loading the compacted file with a -K limit gives the same table
+	as the full file with L eviction. With O a device paired again keeps the place
+	it was first added in while it is in the table, which no single order can
+	match for every limit, so the kept devices and their order may differ.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "Threads.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "InfoStore.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "infostore";
+#endif
+#include "Debug.h"
+
+// Records are padded to 64 bytes in files
+#define INFO_RECORD_SIZE	64
+
+// Globals
+static char* storeFile = NULL;
+static char* storeTemp = NULL;
+static BaxInfo_t* storeQueue = NULL;			/* Records waiting for the writer */
+static unsigned long storeQueued = 0;
+static unsigned long storeQueueSize = 0;
+static mutex_t storeLock;
+static thread_t storeThread;
+static volatile int storeStop = FALSE;
+static unsigned char storeOpen = FALSE;
+// Writer thread only
+static uint32_t* storeSeen = NULL;				/* Addresses in the file by hash, 0 if empty */
+static unsigned long storeSeenSize = 0;
+static unsigned long storeRecords = 0;			/* Records in the file */
+static unsigned long storeUnique = 0;			/* Addresses in the file */
+static unsigned char storeCounted = TRUE;		/* FALSE if an address did not fit in storeSeen */
+
+// Code
+static uint32_t InfoHash(uint32_t address)
+{
+	uint32_t hash = address * 0x9E3779B1ul;
+	return hash ^ (hash >> 16);
+}
+
+// Slot holding the address, or the empty slot ending its probe sequence
+static unsigned long InfoFind(const uint32_t* table, unsigned long size, uint32_t address)
+{
+	unsigned long pos = InfoHash(address) & (size - 1);
+	while(table[pos] != 0 && table[pos] != address)
+		pos = (pos + 1) & (size - 1);
+	return pos;
+}
+
+// Add an address to the seen set, TRUE if it is new, -1 if there is no memory for it
+static int InfoSeenAdd(uint32_t address)
+{
+	unsigned long pos;
+	if(address == 0ul) return FALSE;
+	// Keep under half full
+	if((storeUnique * 2) >= storeSeenSize)
+	{
+		unsigned long size = (storeSeenSize != 0) ? (storeSeenSize * 2) : 1024, i;
+		uint32_t* seen = (uint32_t*)calloc(size, sizeof(uint32_t));
+		if(seen == NULL) return -1;
+		for(i = 0; i < storeSeenSize; i++)
+		{
+			if(storeSeen[i] != 0)
+				seen[InfoFind(seen, size, storeSeen[i])] = storeSeen[i];
+		}
+		free(storeSeen);
+		storeSeen = seen;
+		storeSeenSize = size;
+	}
+	pos = InfoFind(storeSeen, storeSeenSize, address);
+	if(storeSeen[pos] == address) return FALSE;
+	storeSeen[pos] = address;
+	storeUnique++;
+	return TRUE;
+}
+
+static void InfoSeenClear(void)
+{
+	if(storeSeen != NULL) memset(storeSeen, 0, storeSeenSize * sizeof(uint32_t));
+	storeRecords = 0;
+	storeUnique = 0;
+	storeCounted = TRUE;
+}
+
+// Count a record written to the file, the counts are short if its address did not fit
+static void InfoSeenCount(uint32_t address)
+{
+	if(InfoSeenAdd(address) < 0) storeCounted = FALSE;
+	storeRecords++;
+}
+
+// Whole records of the file in one buffer, NULL if empty or unreadable
+static unsigned char* InfoReadFile(size_t* count)
+{
+	FILE* file = fopen(storeFile, "rb");
+	unsigned char* records = NULL;
+	long size;
+	*count = 0;
+	if(file == NULL) return NULL;
+	size = FSFileSize(file);
+	if(size >= INFO_RECORD_SIZE)
+	{
+		records = (unsigned char*)malloc((size_t)size);
+		if(records != NULL)
+			*count = fread(records, 1, (size_t)size, file) / INFO_RECORD_SIZE;
+	}
+	fclose(file);
+	return records;
+}
+
+// Rewrite the file with one record per address, FALSE if it was left as it was
+static int InfoStoreCompact(void)
+{
+	unsigned char* records;
+	uint32_t* keys;
+	size_t count, i, kept = 0, size = 1024;
+	FILE* file;
+	int ok;
+
+	records = InfoReadFile(&count);
+	if(records == NULL) return FALSE;
+	while(size <= (count * 2)) size *= 2;
+	keys = (uint32_t*)calloc(size, sizeof(uint32_t));
+	if(keys == NULL)
+	{
+		free(records);
+		return FALSE;
+	}
+
+	// From the end, the last record of each address moves up over the out of date ones
+	for(i = count; i-- > 0;)
+	{
+		const unsigned char* record = &records[i * INFO_RECORD_SIZE];
+		uint32_t address;
+		unsigned long pos;
+		memcpy(&address, record, sizeof(uint32_t));
+		if(address == 0ul) continue;
+		pos = InfoFind(keys, size, address);
+		if(keys[pos] != 0) continue;
+		keys[pos] = address;
+		kept++;
+		memmove(&records[(count - kept) * INFO_RECORD_SIZE], record, INFO_RECORD_SIZE);
+	}
+	free(keys);
+	memmove(records, &records[(count - kept) * INFO_RECORD_SIZE], kept * INFO_RECORD_SIZE);
+
+	// Write a new file then swap it in
+	file = fopen(storeTemp, "wb");
+	if(file == NULL)
+	{
+		free(records);
+		DBG_ERROR("Can not compact %s", storeFile);
+		return FALSE;
+	}
+	ok = (fwrite(records, INFO_RECORD_SIZE, kept, file) == kept) && (fflush(file) == 0);
+#ifdef _WIN32
+	if(ok) ok = (_commit(_fileno(file)) == 0);
+	fclose(file);
+	if(ok) ok = MoveFileExA(storeTemp, storeFile, MOVEFILE_REPLACE_EXISTING);
+#else
+	if(ok) ok = (fsync(fileno(file)) == 0);
+	fclose(file);
+	if(ok) ok = (rename(storeTemp, storeFile) == 0);
+#endif
+	if(!ok)
+	{
+		remove(storeTemp);
+		free(records);
+		DBG_ERROR("Can not compact %s", storeFile);
+		return FALSE;
+	}
+	DBG_INFO("\r\nInfo file compacted, %lu of %lu records kept", (unsigned long)kept, (unsigned long)count);
+
+	// Count again from what was written
+	InfoSeenClear();
+	for(i = 0; i < kept; i++)
+	{
+		uint32_t address;
+		memcpy(&address, &records[i * INFO_RECORD_SIZE], sizeof(uint32_t));
+		InfoSeenCount(address);
+	}
+	free(records);
+	return TRUE;
+}
+
+// Count everything in the file from scratch
+static void InfoSeenRecount(void)
+{
+	unsigned char* records;
+	size_t count, i;
+	records = InfoReadFile(&count);
+	InfoSeenClear();
+	for(i = 0; i < count; i++)
+	{
+		uint32_t address;
+		memcpy(&address, &records[i * INFO_RECORD_SIZE], sizeof(uint32_t));
+		InfoSeenCount(address);
+	}
+	free(records);
+}
+
+// Compact once enough of the file is out of date
+static void InfoStoreCheck(void)
+{
+	// Short counts would overstate what is out of date, skip this pass and count again for the next
+	if(!storeCounted)
+	{
+		DBG_ERROR("Info file counts incomplete, not compacting %s", storeFile);
+		InfoSeenRecount();
+		return;
+	}
+	if(storeRecords < INFO_COMPACT_MIN) return;
+	if(((storeRecords - storeUnique) * 100) < (storeRecords * INFO_COMPACT_PERCENT)) return;
+	InfoStoreCompact();
+}
+
+// Append everything queued in one write
+static void InfoStoreWrite(void)
+{
+	BaxInfo_t* batch;
+	unsigned char* records;
+	unsigned long count, i;
+	FILE* file;
+
+	mutex_lock(&storeLock);
+	batch = storeQueue;
+	count = storeQueued;
+	storeQueue = NULL;
+	storeQueued = storeQueueSize = 0;
+	mutex_unlock(&storeLock);
+	if(count == 0) return;
+
+	records = (unsigned char*)calloc(count, INFO_RECORD_SIZE);
+	file = fopen(storeFile, "ab");
+	if(records == NULL || file == NULL)
+	{
+		DBG_ERROR("Can not write %s", storeFile);
+		if(file != NULL) fclose(file);
+		free(records);
+		free(batch);
+		return;
+	}
+	for(i = 0; i < count; i++)
+		memcpy(&records[i * INFO_RECORD_SIZE], &batch[i], sizeof(BaxInfo_t));
+	if(fwrite(records, INFO_RECORD_SIZE, count, file) != count)
+		DBG_ERROR("Can not write %s", storeFile);
+	fclose(file);
+	DBG_INFO("\r\n%lu info records saved", count);
+
+	for(i = 0; i < count; i++)
+		InfoSeenCount(batch[i].address);
+	free(records);
+	free(batch);
+	InfoStoreCheck();
+}
+
+static thread_return_t InfoStoreThread(void* arg)
+{
+	unsigned long waited;
+
+	// Count what is in the file already, it may need compacting from the start
+	InfoSeenRecount();
+	InfoStoreCheck();
+
+	while(!storeStop)
+	{
+		// Short waits so closing is quick
+		for(waited = 0; waited < INFO_STORE_POLL_MS && !storeStop; waited += 10)
+			usleep(10 * 1000);
+		InfoStoreWrite();
+	}
+	// Anything queued while stopping
+	InfoStoreWrite();
+	return thread_return_value(0);
+}
+
+int InfoStoreOpen(const char* fileName)
+{
+	if(storeOpen) return TRUE;
+	if(fileName == NULL) return FALSE;
+	storeFile = (char*)malloc(strlen(fileName) + 1);
+	storeTemp = (char*)malloc(strlen(fileName) + 5);
+	if(storeFile == NULL || storeTemp == NULL)
+		ErrorExit("Can not make info store");
+	strcpy(storeFile, fileName);
+	strcpy(storeTemp, fileName);
+	strcat(storeTemp, ".tmp");
+	if(mutex_init(&storeLock, NULL))
+		ErrorExit("Can not make info store");
+	storeStop = FALSE;
+	if(thread_create(&storeThread, NULL, InfoStoreThread, NULL))
+		ErrorExit("Can not start info store thread");
+	storeOpen = TRUE;
+	DBG_INFO("\r\nInfo store: %s", storeFile);
+	return TRUE;
+}
+
+void InfoStoreAdd(const BaxInfo_t* info)
+{
+	if(!storeOpen || info == NULL) return;
+	mutex_lock(&storeLock);
+	if(storeQueued >= storeQueueSize)
+	{
+		unsigned long size = (storeQueueSize != 0) ? (storeQueueSize * 2) : 64;
+		BaxInfo_t* queue = (BaxInfo_t*)realloc(storeQueue, size * sizeof(BaxInfo_t));
+		if(queue == NULL)
+		{
+			mutex_unlock(&storeLock);
+			DBG_ERROR("Info record dropped");
+			return;
+		}
+		storeQueue = queue;
+		storeQueueSize = size;
+	}
+	memcpy(&storeQueue[storeQueued++], info, sizeof(BaxInfo_t));
+	mutex_unlock(&storeLock);
+}
+
+void InfoStoreClose(void)
+{
+	if(!storeOpen) return;
+	storeStop = TRUE;
+	thread_join(storeThread, NULL);
+	storeOpen = FALSE;
+	mutex_destroy(&storeLock);
+	free(storeQueue);
+	free(storeSeen);
+	free(storeFile);
+	free(storeTemp);
+	storeQueue = NULL;
+	storeQueued = storeQueueSize = 0;
+	storeSeen = NULL;
+	storeSeenSize = 0;
+	storeRecords = storeUnique = 0;
+	storeCounted = TRUE;
+	storeFile = storeTemp = NULL;
+}
+
+//EOF
@@ -0,0 +1,22 @@
+// Device info file writer, pairing and name records are appended in batches on
+// a thread and the file is compacted when most of it is out of date
+#ifndef _INFO_STORE_H_
+#define _INFO_STORE_H_
+
+#include "BaxRx.h"
+
+// Definitions
+#define INFO_STORE_POLL_MS		100		/* Writer wait between batches */
+#define INFO_COMPACT_MIN		1024	/* Records in the file before it is compacted */
+#define INFO_COMPACT_PERCENT	50		/* Out of date records that start a compaction */
+
+// Prototypes
+// Start writing records to the file, it is checked for compaction first
+int InfoStoreOpen(const char* fileName);
+// Queue a record, ignored if the store is not open
+void InfoStoreAdd(const BaxInfo_t* info);
+// Write everything queued and stop the writer
+void InfoStoreClose(void);
+
+#endif
+//EOF
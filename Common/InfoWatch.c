@@ -0,0 +1,369 @@
+/*
+	Info file reloading
+	A thread waits on inotify for the info file to be written or renamed into
+	place. Once it has been quiet for INFO_WATCH_SETTLE_MS the file is read and
+	compared with the last copy. Keys for new and changed devices are expanded
+	on the thread and the finished set of changes is handed over with one
+	pointer swap. The decoding thread merges it between packets, so lookups
+	never wait on the file and never see half of a reload. Devices paired
+	while running are kept even if the new file does not have them.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Config.h"
+#include "Threads.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "InfoWatch.h"
+
+#ifdef __linux__
+	#include <errno.h>
+	#include <poll.h>
+	#include <unistd.h>
+	#include <sys/inotify.h>
+#endif
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "infowatch";
+#endif
+#include "Debug.h"
+
+#ifdef __linux__
+// Records are padded to 64 bytes in files
+#define INFO_RECORD_SIZE	64
+
+// Types
+typedef struct {
+	BaxInfoUpdate_t* updates;	/* New or changed devices, in file order */
+	unsigned long count;
+	uint32_t* removed;			/* Addresses no longer in the file */
+	unsigned long removedCount;
+} InfoReload_t;
+
+typedef struct {
+	uint32_t* keys;				/* Address by hash, 0 if empty */
+	BaxInfo_t* records;			/* Last record for the address */
+	unsigned long size;			/* Power of 2 */
+} InfoCopy_t;
+
+// Globals
+static char* watchFile = NULL;
+static const char* watchName = NULL;	/* File name without the directory */
+static int watchFd = -1;
+static thread_t watchThread;
+static volatile int watchStop = FALSE;
+static unsigned char watchOpen = FALSE;
+static InfoReload_t* volatile watchReady = NULL;	/* Reload waiting to be merged */
+static InfoCopy_t watchCopy;					/* Watcher thread only */
+
+// Code
+static unsigned long InfoCopyFind(const InfoCopy_t* copy, uint32_t address)
+{
+	uint32_t hash = address * 0x9E3779B1ul;
+	unsigned long pos = (hash ^ (hash >> 16)) & (copy->size - 1);
+	while(copy->keys[pos] != 0 && copy->keys[pos] != address)
+		pos = (pos + 1) & (copy->size - 1);
+	return pos;
+}
+
+static void InfoCopyFree(InfoCopy_t* copy)
+{
+	free(copy->keys);
+	free(copy->records);
+	memset(copy, 0, sizeof(InfoCopy_t));
+}
+
+static void InfoReloadFree(InfoReload_t* reload)
+{
+	if(reload == NULL) return;
+	free(reload->updates);
+	free(reload->removed);
+	free(reload);
+}
+
+// Read the file, FALSE if out of memory (a missing file is empty)
+static int InfoReadCopy(InfoCopy_t* copy, unsigned char** records, size_t* count)
+{
+	FILE* file = fopen(watchFile, "rb");
+	long length = 0;
+	*records = NULL;
+	*count = 0;
+	if(file != NULL)
+	{
+		length = FSFileSize(file);
+		if(length >= INFO_RECORD_SIZE)
+		{
+			*records = (unsigned char*)malloc((size_t)length);
+			if(*records != NULL)
+				*count = fread(*records, 1, (size_t)length, file) / INFO_RECORD_SIZE;
+		}
+		fclose(file);
+		if(length >= INFO_RECORD_SIZE && *records == NULL) return FALSE;
+	}
+	// Last record for each address wins
+	copy->size = 1024;
+	while(copy->size <= (*count * 2)) copy->size *= 2;
+	copy->keys = (uint32_t*)calloc(copy->size, sizeof(uint32_t));
+	copy->records = (BaxInfo_t*)malloc(copy->size * sizeof(BaxInfo_t));
+	if(copy->keys == NULL || copy->records == NULL)
+	{
+		InfoCopyFree(copy);
+		free(*records);
+		*records = NULL;
+		return FALSE;
+	}
+	{
+		size_t i;
+		for(i = 0; i < *count; i++)
+		{
+			BaxInfo_t info;
+			unsigned long pos;
+			memcpy(&info, &(*records)[i * INFO_RECORD_SIZE], sizeof(BaxInfo_t));
+			if(info.address == 0ul) continue;
+			pos = InfoCopyFind(copy, info.address);
+			copy->keys[pos] = info.address;
+			memcpy(&copy->records[pos], &info, sizeof(BaxInfo_t));
+		}
+	}
+	return TRUE;
+}
+
+// Compare the file with the last copy, NULL if nothing changed
+static InfoReload_t* InfoWatchDiff(void)
+{
+	InfoCopy_t copy;
+	InfoReload_t* reload;
+	unsigned char* records;
+	unsigned char* done;
+	size_t count, i;
+
+	memset(&copy, 0, sizeof(copy));
+	if(!InfoReadCopy(&copy, &records, &count))
+	{
+		DBG_ERROR("Can not reload %s", watchFile);
+		return NULL;
+	}
+	reload = (InfoReload_t*)calloc(1, sizeof(InfoReload_t));
+	done = (unsigned char*)calloc(copy.size, 1);
+	if(reload != NULL)
+	{
+		reload->updates = (BaxInfoUpdate_t*)malloc((count + 1) * sizeof(BaxInfoUpdate_t));
+		reload->removed = (uint32_t*)malloc((watchCopy.size + 1) * sizeof(uint32_t));
+	}
+	if(reload == NULL || done == NULL || reload->updates == NULL || reload->removed == NULL)
+	{
+		DBG_ERROR("Can not reload %s", watchFile);
+		InfoReloadFree(reload);
+		free(done);
+		free(records);
+		InfoCopyFree(&copy);
+		return NULL;
+	}
+
+	// New and changed devices where they first appear, with their last record
+	for(i = 0; i < count; i++)
+	{
+		uint32_t address;
+		unsigned long pos, old;
+		memcpy(&address, &records[i * INFO_RECORD_SIZE], sizeof(uint32_t));
+		if(address == 0ul) continue;
+		pos = InfoCopyFind(&copy, address);
+		if(done[pos]) continue;
+		done[pos] = TRUE;
+		if(watchCopy.size != 0)
+		{
+			old = InfoCopyFind(&watchCopy, address);
+			if(watchCopy.keys[old] != 0 && memcmp(&watchCopy.records[old], &copy.records[pos], sizeof(BaxInfo_t)) == 0) continue;
+		}
+		BaxPrepareInfo(&reload->updates[reload->count++], &copy.records[pos]);
+	}
+	// Devices gone from the file
+	for(i = 0; i < watchCopy.size; i++)
+	{
+		if(watchCopy.keys[i] == 0) continue;
+		if(copy.keys[InfoCopyFind(&copy, watchCopy.keys[i])] == 0)
+			reload->removed[reload->removedCount++] = watchCopy.keys[i];
+	}
+	free(done);
+	free(records);
+
+	// The file as it is now is compared with next time
+	InfoCopyFree(&watchCopy);
+	watchCopy = copy;
+	if(reload->count == 0 && reload->removedCount == 0)
+	{
+		InfoReloadFree(reload);
+		return NULL;
+	}
+	DBG_INFO("\r\nInfo file reloaded, %lu changed, %lu removed", reload->count, reload->removedCount);
+	return reload;
+}
+
+// TRUE if any event is for the watched file
+static int InfoWatchEvents(void)
+{
+	char buffer[4096];
+	const struct inotify_event* event;
+	ssize_t length, pos;
+	int changed = FALSE;
+	for(;;)
+	{
+		length = read(watchFd, buffer, sizeof(buffer));
+		if(length <= 0) break;
+		for(pos = 0; pos < length; pos += sizeof(struct inotify_event) + event->len)
+		{
+			event = (const struct inotify_event*)&buffer[pos];
+			if(event->len != 0 && strcmp(event->name, watchName) == 0)
+				changed = TRUE;
+		}
+	}
+	return changed;
+}
+
+static thread_return_t InfoWatchThread(void* arg)
+{
+	struct pollfd pfd;
+	int pending = FALSE;
+	InfoReload_t* reload;
+	unsigned char* records;
+	size_t count;
+
+	// The file as it was loaded
+	if(InfoReadCopy(&watchCopy, &records, &count))
+		free(records);
+
+	pfd.fd = watchFd;
+	pfd.events = POLLIN;
+	while(!watchStop)
+	{
+		pfd.revents = 0;
+		if(poll(&pfd, 1, pending ? INFO_WATCH_SETTLE_MS : INFO_WATCH_POLL_MS) < 0)
+		{
+			if(errno == EINTR) continue;
+			break;
+		}
+		if(pfd.revents & POLLIN)
+		{
+			// Wait for the writer to finish
+			if(InfoWatchEvents()) pending = TRUE;
+			continue;
+		}
+		if(!pending) continue;
+		pending = FALSE;
+
+		reload = InfoWatchDiff();
+		if(reload == NULL) continue;
+		// The last reload has to be merged first
+		while(watchReady != NULL && !watchStop)
+			usleep(10 * 1000);
+		if(watchStop)
+		{
+			InfoReloadFree(reload);
+			break;
+		}
+		(void)atomic_exchange_ptr(&watchReady, reload);
+	}
+	return thread_return_value(0);
+}
+
+int InfoWatchOpen(const char* fileName)
+{
+	char* slash;
+	if(watchOpen) return TRUE;
+	if(fileName == NULL) return FALSE;
+	watchFile = (char*)malloc(strlen(fileName) + 1);
+	if(watchFile == NULL) return FALSE;
+	strcpy(watchFile, fileName);
+
+	// Files are often replaced by a rename so the directory is watched
+	watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	slash = strrchr(watchFile, '/');
+	if(slash != NULL)
+	{
+		*slash = '\0';
+		watchName = slash + 1;
+		if(watchFd >= 0 && inotify_add_watch(watchFd, (slash == watchFile) ? "/" : watchFile, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			close(watchFd);
+			watchFd = -1;
+		}
+		*slash = '/';
+	}
+	else
+	{
+		watchName = watchFile;
+		if(watchFd >= 0 && inotify_add_watch(watchFd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			close(watchFd);
+			watchFd = -1;
+		}
+	}
+	if(watchFd < 0)
+	{
+		DBG_ERROR("Can not watch %s", fileName);
+		free(watchFile);
+		watchFile = NULL;
+		return FALSE;
+	}
+
+	watchStop = FALSE;
+	if(thread_create(&watchThread, NULL, InfoWatchThread, NULL))
+		ErrorExit("Can not start info watch thread");
+	watchOpen = TRUE;
+	DBG_INFO("\r\nWatching %s", watchFile);
+	return TRUE;
+}
+
+int InfoWatchTasks(void)
+{
+	InfoReload_t* reload;
+	if(watchReady == NULL) return FALSE;
+	reload = (InfoReload_t*)atomic_exchange_ptr(&watchReady, NULL);
+	if(reload == NULL) return FALSE;
+	BaxMergeInfo(reload->updates, reload->count, reload->removed, reload->removedCount);
+	InfoReloadFree(reload);
+	return TRUE;
+}
+
+void InfoWatchClose(void)
+{
+	if(!watchOpen) return;
+	watchStop = TRUE;
+	thread_join(watchThread, NULL);
+	watchOpen = FALSE;
+	InfoReloadFree((InfoReload_t*)atomic_exchange_ptr(&watchReady, NULL));
+	InfoCopyFree(&watchCopy);
+	close(watchFd);
+	watchFd = -1;
+	free(watchFile);
+	watchFile = NULL;
+	watchName = NULL;
+}
+
+#else
+// Needs inotify
+int InfoWatchOpen(const char* fileName)
+{
+	DBG_ERROR("Info file watching not supported");
+	return FALSE;
+}
+int InfoWatchTasks(void)
+{
+	return FALSE;
+}
+void InfoWatchClose(void)
+{
+}
+#endif
+
+//EOF
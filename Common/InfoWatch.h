@@ -0,0 +1,21 @@
+// Info file reloading, the file is watched and changed devices are merged into
+// the device table without stopping the decoder
+#ifndef _INFO_WATCH_H_
+#define _INFO_WATCH_H_
+
+#include "BaxRx.h"
+
+// Definitions
+#define INFO_WATCH_POLL_MS		100		/* Watcher wait before checking for exit */
+#define INFO_WATCH_SETTLE_MS	200		/* Quiet time after a change before the file is read */
+
+// Prototypes
+// Start watching the file (linux only), FALSE if it can not be watched
+int InfoWatchOpen(const char* fileName);
+// Merge a finished reload into the device table, call from the decoding thread - TRUE if one was merged
+int InfoWatchTasks(void);
+// Stop watching
+void InfoWatchClose(void);
+
+#endif
+//EOF
@@ -0,0 +1,233 @@
+/*
+	Parallel decoder for binary unit files
+	The mapped file is split into unit aligned jobs which are decrypted and
+	formatted by worker threads, the output is written back in file order.
+	Pairing and name packets update the device table so they end a round
+	and are processed in order on the calling thread.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Config.h"
+#include "Threads.h"
+#include "BaxUtils.h"
+#include "BaxRx.h"
+#include "Offline.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "offline";
+#endif
+#include "Debug.h"
+
+// Types
+typedef struct {
+	uint32_t address;
+	DateTime time;				/* Unit timestamp */
+	unsigned char pktId;
+	size_t start;				/* Formatted output of the unit, len 0 if filtered */
+	size_t len;
+} OfflineMark_t;
+
+typedef struct {
+	const unsigned char* units;	/* First unit of the job (in the mapped file) */
+	size_t count;				/* Number of units */
+	char* out;					/* Formatted output */
+	size_t outLen;
+	size_t outSize;
+	OfflineMark_t* marks;		/* Decrypted units, their packet ids are counted in file order */
+	size_t markCount;
+	size_t markSize;
+	unsigned char failed;
+	thread_t thread;
+} OfflineJob_t;
+
+// Prototypes
+extern int BaxProcessUnit(unsigned char* packedUnit);
+extern int BaxDecodeUnits(const unsigned char* units, BaxPacket_t* pkts, unsigned char* pass, unsigned short count, unsigned char shared);
+extern int BaxFormatUnit(char* buffer, const unsigned char* packedUnit, BaxPacket_t* pkt);
+
+// Code
+static thread_return_t OfflineWorker(void* arg)
+{
+	OfflineJob_t* job = (OfflineJob_t*)arg;
+	BaxPacket_t pkts[BAX_DECRYPT_BATCH];
+	unsigned char pass[BAX_DECRYPT_BATCH];
+	OfflineMark_t* mark;
+	unsigned short n, i;
+	size_t pos;
+
+	job->outLen = 0;
+	job->markCount = 0;
+	for(pos = 0; pos < job->count && !job->failed; pos += n)
+	{
+		const unsigned char* units = job->units + (pos * BINARY_DATA_UNIT_SIZE);
+		// Decrypt a batch and filter, device table is shared
+		n = (job->count - pos > BAX_DECRYPT_BATCH) ? BAX_DECRYPT_BATCH : (unsigned short)(job->count - pos);
+		BaxDecodeUnits(units, pkts, pass, n, TRUE);
+		for(i = 0; i < n; i++)
+		{
+			mark = NULL;
+			// Note decrypted units, repeats are taken out when written
+			if(units[(i * BINARY_DATA_UNIT_SIZE) + BAX_OFFSET_BINARY_UNIT + BAX_FIELD_OS_pktType] > (unsigned char)ENCRYPTED_PKT_TYPE_OFFSET &&
+				(unsigned char)pkts[i].pktType <= (unsigned char)ENCRYPTED_PKT_TYPE_OFFSET)
+			{
+				if(job->markCount >= job->markSize)
+				{
+					size_t size = (job->markSize * 2) + BAX_DECRYPT_BATCH;
+					OfflineMark_t* marks = (OfflineMark_t*)realloc(job->marks, size * sizeof(OfflineMark_t));
+					if(marks == NULL)
+					{
+						job->failed = TRUE;
+						break;
+					}
+					job->marks = marks;
+					job->markSize = size;
+				}
+				mark = &job->marks[job->markCount++];
+				mark->address = pkts[i].address;
+				mark->time = UnpackLE32((unsigned char*)units + (i * BINARY_DATA_UNIT_SIZE), 4);
+				mark->pktId = pkts[i].data[BAX_FIELD_OS_pktId];
+				mark->start = job->outLen;
+				mark->len = 0;
+			}
+			if(!pass[i]) continue;
+			// Grow output to fit another unit
+			if((job->outSize - job->outLen) < SERIAL_WRITE_BUFFER_SIZE)
+			{
+				size_t size = (job->outSize * 2) + SERIAL_WRITE_BUFFER_SIZE;
+				char* out = (char*)realloc(job->out, size);
+				if(out == NULL)
+				{
+					job->failed = TRUE;
+					break;
+				}
+				job->out = out;
+				job->outSize = size;
+			}
+			job->outLen += BaxFormatUnit(job->out + job->outLen, units + (i * BINARY_DATA_UNIT_SIZE), &pkts[i]);
+			if(mark != NULL) mark->len = job->outLen - mark->start;
+		}
+	}
+	return thread_return_value(0);
+}
+
+// Write a job's output, counting its packet ids in order and leaving out repeats
+static void OfflineWrite(OfflineJob_t* job, FILE* file)
+{
+	size_t pos = 0, i;
+	for(i = 0; i < job->markCount; i++)
+	{
+		const OfflineMark_t* mark = &job->marks[i];
+		if(BaxTrackSequence(mark->address, mark->pktId, mark->time)) continue;
+		if(mark->start > pos && fwrite(job->out + pos, sizeof(char), mark->start - pos, file) != (mark->start - pos))
+		{
+			DBG_ERROR("Output write error");
+		}
+		pos = mark->start + mark->len;
+	}
+	if(job->outLen > pos && fwrite(job->out + pos, sizeof(char), job->outLen - pos, file) != (job->outLen - pos))
+	{
+		DBG_ERROR("Output write error");
+	}
+}
+
+int OfflineDecode(Settings_t* settings)
+{
+	OfflineJob_t jobs[OFFLINE_MAX_THREADS];
+	unsigned short threads, i;
+	size_t pos, end, total;
+	int ret = TRUE;
+
+	// Only mapped binary unit files
+	threads = settings->threads;
+	if(threads > OFFLINE_MAX_THREADS) threads = OFFLINE_MAX_THREADS;
+	if(threads < 2 || settings->inputMap == NULL) return FALSE;
+	// Least recently heard eviction needs every packet seen in order
+	if(settings->infoLimit != 0 && settings->infoEvict == BAX_EVICT_LRU) return FALSE;
+	// So do the aggregates and column blocks
+	if(settings->outMode == 'A' || settings->outMode == 'B') return FALSE;
+
+	memset(jobs, 0, sizeof(jobs));
+	total = settings->inputMapLen - (settings->inputMapLen % BINARY_DATA_UNIT_SIZE);
+	pos = settings->inputMapPos;
+	DBG_INFO("\r\nOffline decode, %lu units on %u threads",(unsigned long)((total - pos) / BINARY_DATA_UNIT_SIZE), threads);
+
+	while(pos < total)
+	{
+		size_t count, per, offset;
+
+		// Size the round, stopping before any packet that changes the device table
+		end = pos + ((size_t)threads * OFFLINE_UNITS_PER_JOB * BINARY_DATA_UNIT_SIZE);
+		if(end > total) end = total;
+		if(settings->linkMode & LINK_FLAG_ADD)
+		{
+			for(offset = pos; offset < end; offset += BINARY_DATA_UNIT_SIZE)
+			{
+				if(IS_INFO_UNIT(settings->inputMap + offset)) break;
+			}
+			end = offset;
+		}
+
+		// Split between threads and start them
+		count = (end - pos) / BINARY_DATA_UNIT_SIZE;
+		per = (count + threads - 1) / threads;
+		offset = pos;
+		for(i = 0; i < threads; i++)
+		{
+			jobs[i].units = settings->inputMap + offset;
+			jobs[i].count = (count > per) ? per : count;
+			count -= jobs[i].count;
+			offset += jobs[i].count * BINARY_DATA_UNIT_SIZE;
+			if(jobs[i].count == 0) continue;
+			if(thread_create(&jobs[i].thread, NULL, OfflineWorker, &jobs[i]))
+			{
+				// Could not start, decode here instead
+				OfflineWorker(&jobs[i]);
+				jobs[i].count = 0;
+			}
+		}
+
+		// Wait and write out in order
+		for(i = 0; i < threads; i++)
+		{
+			if(jobs[i].count != 0)
+				thread_join(jobs[i].thread, NULL);
+			if(jobs[i].failed)
+			{
+				DBG_ERROR("Offline decode out of memory");
+				ret = -1;
+			}
+			OfflineWrite(&jobs[i], settings->outputFile);
+			jobs[i].outLen = 0;
+			jobs[i].markCount = 0;
+		}
+		if(ret < 0) break;
+		pos = end;
+
+		// Pairing and name packets go through the normal handler
+		if(pos < total && IS_INFO_UNIT(settings->inputMap + pos))
+		{
+			BaxProcessUnit((unsigned char*)&settings->inputMap[pos]);
+			pos += BINARY_DATA_UNIT_SIZE;
+		}
+	}
+	settings->inputMapPos = pos;
+
+	// Release buffers
+	for(i = 0; i < threads; i++)
+	{
+		if(jobs[i].out != NULL) free(jobs[i].out);
+		if(jobs[i].marks != NULL) free(jobs[i].marks);
+	}
+	return ret;
+}
+
+//EOF
@@ -0,0 +1,16 @@
+// Parallel decoder for binary unit files
+#ifndef _OFFLINE_H_
+#define _OFFLINE_H_
+
+#include "Config.h"
+
+// Definitions
+#define OFFLINE_MAX_THREADS		64		/* Upper limit on decode threads */
+#define OFFLINE_UNITS_PER_JOB	16384	/* Units given to each thread per round */
+
+// Prototypes
+// Decode a mapped binary unit file on settings->threads workers, FALSE if not possible
+int OfflineDecode(Settings_t* settings);
+
+#endif
+//EOF
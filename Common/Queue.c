@@ -0,0 +1,122 @@
+/*
+	Bounded lock-free unit queue
+	Each slot carries a sequence number, producers claim a position with a
+	compare and swap on the head then publish the slot by advancing its
+	sequence. The single consumer reads slots in order without locking.
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+	#include <windows.h>
+#else
+	#include <unistd.h>
+	#ifdef __linux__
+		#include <sys/eventfd.h>
+	#endif
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "Threads.h"
+#include "Queue.h"
+
+// Code
+int QueueInit(UnitQueue_t* queue, unsigned long size)
+{
+	unsigned long i;
+	memset(queue, 0, sizeof(UnitQueue_t));
+	queue->signalFd = -1;
+	// Power of 2 sizes only
+	if(size == 0 || (size & (size - 1)) != 0) return FALSE;
+	queue->slots = (QueueSlot_t*)malloc(size * sizeof(QueueSlot_t));
+	if(queue->slots == NULL) return FALSE;
+	for(i = 0; i < size; i++)
+		queue->slots[i].sequence = i;
+	queue->mask = size - 1;
+#ifdef __linux__
+	queue->signalFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+	return TRUE;
+}
+
+void QueueFree(UnitQueue_t* queue)
+{
+	if(queue->slots != NULL) free(queue->slots);
+	queue->slots = NULL;
+#ifndef _WIN32
+	if(queue->signalFd >= 0) close(queue->signalFd);
+#endif
+	queue->signalFd = -1;
+}
+
+int QueuePush(UnitQueue_t* queue, const unsigned char* unit)
+{
+	QueueSlot_t* slot;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = atomic_load_acquire(&queue->head);
+	for(;;)
+	{
+		slot = &queue->slots[pos & queue->mask];
+		seq = atomic_load_acquire(&slot->sequence);
+		diff = (long)(seq - pos);
+		if(diff == 0)
+		{
+			// Slot is free for this position, claim it
+			if(atomic_cas(&queue->head, pos, pos + 1)) break;
+			pos = atomic_load_acquire(&queue->head);
+		}
+		else if(diff < 0)
+		{
+			// Consumer has not freed it yet
+			return FALSE;
+		}
+		else
+		{
+			// Another producer took it
+			pos = atomic_load_acquire(&queue->head);
+		}
+	}
+	memcpy(slot->unit, unit, BINARY_DATA_UNIT_SIZE);
+	atomic_store_release(&slot->sequence, pos + 1);
+	return TRUE;
+}
+
+int QueuePop(UnitQueue_t* queue, unsigned char* unit)
+{
+	QueueSlot_t* slot = &queue->slots[queue->tail & queue->mask];
+	unsigned long seq = atomic_load_acquire(&slot->sequence);
+	// Not yet published
+	if((long)(seq - (queue->tail + 1)) < 0) return FALSE;
+	memcpy(unit, slot->unit, BINARY_DATA_UNIT_SIZE);
+	// Free the slot for the producers next time round
+	atomic_store_release(&slot->sequence, queue->tail + queue->mask + 1);
+	queue->tail++;
+	return TRUE;
+}
+
+void QueueSignal(UnitQueue_t* queue)
+{
+#ifdef __linux__
+	uint64_t value = 1;
+	if(queue->signalFd >= 0 && write(queue->signalFd, &value, sizeof(value)) != sizeof(value))
+	{
+		// Counter full, consumer is already due to wake
+	}
+#endif
+}
+
+void QueueClearSignal(UnitQueue_t* queue)
+{
+#ifdef __linux__
+	uint64_t value;
+	if(queue->signalFd >= 0 && read(queue->signalFd, &value, sizeof(value)) != sizeof(value))
+	{
+		// Nothing pending
+	}
+#endif
+}
+
+//EOF
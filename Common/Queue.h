@@ -0,0 +1,34 @@
+// Bounded lock-free unit queue, many producers and a single consumer
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include "BaxUtils.h"
+
+// Types
+typedef struct {
+	volatile unsigned long sequence;				/* Position the slot is ready for */
+	unsigned char unit[BINARY_DATA_UNIT_SIZE];
+} QueueSlot_t;
+
+typedef struct {
+	QueueSlot_t* slots;
+	unsigned long mask;								/* Slot count - 1 (power of 2) */
+	volatile unsigned long head;					/* Next push position, shared by producers */
+	unsigned long tail;								/* Next pop position, consumer only */
+	int signalFd;									/* Consumer wake up (eventfd), -1 if polled */
+} UnitQueue_t;
+
+// Prototypes
+// Size must be a power of 2, FALSE on failure
+int QueueInit(UnitQueue_t* queue, unsigned long size);
+void QueueFree(UnitQueue_t* queue);
+// Producers, FALSE if full
+int QueuePush(UnitQueue_t* queue, const unsigned char* unit);
+// Consumer, FALSE if empty
+int QueuePop(UnitQueue_t* queue, unsigned char* unit);
+// Wake up the consumer / clear the wake up before draining
+void QueueSignal(UnitQueue_t* queue);
+void QueueClearSignal(UnitQueue_t* queue);
+
+#endif
+//EOF
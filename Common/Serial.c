@@ -169,6 +169,13 @@ int getcSerial(Settings_t* settings)
 	else ret = -1;
 	return ret;
 }
+// Block reader, typedef int (*ReadBlock_t)(Settings_t* settings, unsigned char* buffer, int maxLen);
+int readSerial(Settings_t* settings, unsigned char* buffer, int maxLen)
+{
+	if(settings->fd < 0) return -1;
+	// Single read, returns whatever the port has
+	return readport(settings->fd, buffer, maxLen, 0);
+}
 // Shim for api cross compatibility to typedef int (*PutByte_t)(Settings_t* settings, unsigned char b);
 int putcSerial(Settings_t* settings, unsigned char b)
 {
@@ -14,6 +14,8 @@ int readport(int fd, unsigned char *buffer, size_t len, unsigned int timeout);
 
 // Shim for api cross compatibility to typedef int (*GetByte_t)(Settings_t* settings);
 int getcSerial(Settings_t* settings);
+// Block reader, typedef int (*ReadBlock_t)(Settings_t* settings, unsigned char* buffer, int maxLen);
+int readSerial(Settings_t* settings, unsigned char* buffer, int maxLen);
 // Shim for api cross compatibility to typedef int (*PutByte_t)(Settings_t* settings, unsigned char b);
 int putcSerial(Settings_t* settings, unsigned char b);
 
@@ -83,7 +83,7 @@ Si44Event_t* Si44Command(const Si44Cmd_t* cmd, void* buffer)
 	else if (gSettings.encoding == 'S')
 	{
 		encodedCmd[0] = SLIP_START_OF_PACKET;
-		sendLen = WriteToSlip(&encodedCmd[1], binaryCmd, 2+cmd->len, FALSE);
+		sendLen = WriteToSlip(&encodedCmd[1], binaryCmd, 2+cmd->len, SERIAL_WRITE_BUFFER_SIZE - 2);
 		encodedCmd[1+sendLen] = SLIP_END_OF_PACKET;
 		sendLen+=2;		
 	}
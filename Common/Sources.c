@@ -0,0 +1,302 @@
+/*
+	Multiple inputs
+	Every descriptor gets a copy of the settings and a reader thread which
+	frames and decodes its input into binary units. The units are pushed onto
+	one lock-free queue and the main thread takes them off in arrival order,
+	so decryption, the device key table and the output stay single threaded.
+	Each reader sets its bit in the spare byte of its units and copies of a
+	transmission from several receivers are merged there (Dedupe.c).
+*/
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_DEPRECATE
+#else
+	#include <errno.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Config.h"
+#include "Threads.h"
+#include "BaxUtils.h"
+#include "Queue.h"
+#include "Dedupe.h"
+#include "UDP.h"
+#include "Sources.h"
+
+// Debug setting
+#undef DEBUG_LEVEL
+#define DEBUG_LEVEL	0
+#define DBG_FILE dbg_file
+#if (DEBUG_LEVEL > 0)||(GLOBAL_DEBUG_LEVEL > 0)
+static const char* dbg_file = "sources";
+#endif
+#include "Debug.h"
+
+// Types
+typedef struct {
+	Settings_t settings;	/* Copy of the global settings for this input */
+	Framer_t framer;
+	unsigned char buffer[FRAMER_BUFFER_SIZE];
+	thread_t thread;
+	unsigned char opened;
+	unsigned char started;
+} Source_t;
+
+// Globals
+static Source_t* sources = NULL;
+static unsigned char sourceCount = 0;
+static UnitQueue_t sourceQueue;
+static volatile unsigned long sourcesRunning = 0;
+static volatile int sourcesStop = FALSE;
+static unsigned char sourceDedupe = FALSE;		/* Copies of a unit from several receivers are merged */
+static int (*sourceHandler)(unsigned char* unit) = NULL;	/* Last handler, for units held when closing */
+
+// Code
+// Queue a unit, waits for the output to catch up if the queue is full
+static int SourcePushUnit(unsigned char* unit)
+{
+	while(!QueuePush(&sourceQueue, unit))
+	{
+		if(sourcesStop) return FALSE;
+		QueueSignal(&sourceQueue);
+		usleep(1000);
+	}
+	return TRUE;
+}
+
+// Pass a unit to the handler, or hold it for copies from the other receivers
+static void SourceUnit(unsigned char* unit, unsigned long long now)
+{
+	if(sourceDedupe)
+		DedupeAdd(unit, now, sourceHandler);
+	else
+		sourceHandler(unit);
+}
+
+// Wait for input, FALSE if the input has closed
+static int SourceWait(Settings_t* settings)
+{
+#ifndef _WIN32
+	struct pollfd pfd;
+	pfd.fd = TransportWaitFd(settings);
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if(pfd.fd < 0)
+	{
+		usleep(SOURCE_POLL_MS * 1000);
+		return TRUE;
+	}
+	if(poll(&pfd, 1, SOURCE_POLL_MS) < 0)
+		return (errno == EINTR);
+	if(pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+	{
+		DBG_ERROR("Source %s closed", settings->input);
+		return FALSE;
+	}
+#endif
+	// Windows reads have their own timeouts
+	return TRUE;
+}
+
+static thread_return_t SourceThread(void* arg)
+{
+	Source_t* source = (Source_t*)arg;
+	Settings_t* settings = &source->settings;
+	unsigned char rawData[MAX_BINARY_PACKET_LEN];
+	unsigned char *frame, *unit;
+	unsigned short pending = 0;
+	unsigned int length;
+
+	while(!sourcesStop)
+	{
+		if(settings->source == 'U')
+		{
+			// Whole datagrams from the receive ring
+			if(UdpReadUnits(settings, SourcePushUnit) > 0)
+			{
+				QueueSignal(&sourceQueue);
+				continue;
+			}
+		}
+		else
+		{
+			// Everything complete in the read buffer
+			frame = FramerGet(&source->framer, settings, &length);
+			if(frame != NULL)
+			{
+				for(; frame != NULL; frame = FramerNext(&source->framer, &length))
+				{
+					unit = TransportDecodeFrame(settings, frame, &length, rawData);
+					if(length != BINARY_DATA_UNIT_SIZE)
+					{
+						DBG_ERROR("Binary unit not 32 bytes?");
+						continue;
+					}
+					unit[BAX_OFFSET_RECEIVERS] |= settings->receiver;
+					SourcePushUnit(unit);
+					// Wake the output every few units while busy
+					if(++pending >= SOURCE_SIGNAL_UNITS)
+					{
+						QueueSignal(&sourceQueue);
+						pending = 0;
+					}
+				}
+				continue;
+			}
+			if(pending > 0)
+			{
+				QueueSignal(&sourceQueue);
+				pending = 0;
+			}
+		}
+		// Nothing ready
+		if(!SourceWait(settings)) break;
+		// Units held for copies from other receivers still time out when the inputs are quiet
+		if(sourceDedupe) QueueSignal(&sourceQueue);
+	}
+
+	atomic_add(&sourcesRunning, -1);
+	QueueSignal(&sourceQueue);
+	return thread_return_value(0);
+}
+
+int SourcesOpen(Settings_t* settings)
+{
+	unsigned char i, udpCount = 0;
+
+	// Sources are merged as binary units
+	if(settings->format != 'U')
+		ErrorExit("Multiple sources need binary unit input (-fU)");
+	if(!QueueInit(&sourceQueue, SOURCE_QUEUE_UNITS))
+		ErrorExit("Can not make source queue");
+	sources = (Source_t*)calloc(settings->inputCount, sizeof(Source_t));
+	if(sources == NULL)
+		ErrorExit("Can not make sources");
+	sourceCount = settings->inputCount;
+
+	// Open each input with its own settings
+	for(i = 0; i < sourceCount; i++)
+	{
+		Settings_t* source = &sources[i].settings;
+		memcpy(source, settings, sizeof(Settings_t));
+		source->input = settings->inputs[i];
+		source->inputCount = 1;
+		source->receiver = (unsigned char)(1u << i);
+		FramerInit(&sources[i].framer, source->encoding, sources[i].buffer, sizeof(sources[i].buffer), 0);
+		source->framer = &sources[i].framer;
+		// Router descriptors have '+' separated fields, each router forwards to its own port
+		if(strchr(source->input, '+') != NULL)
+		{
+			source->source = 'U';
+			source->udpLocalPort = settings->udpLocalPort + udpCount++;
+		}
+		if(source->source != 'S' && source->source != 'U')
+			ErrorExit("Only serial and UDP sources can be combined: %s", source->input);
+		DBG_INFO("\r\nSource %u: %c %s", i, source->source, source->input);
+		OpenTransport(source);
+		sources[i].opened = TRUE;
+#ifndef _WIN32
+		// Readers wait with poll
+		TransportNoWait(source);
+#endif
+	}
+
+	// Units heard by several receivers are passed on once
+	sourceDedupe = FALSE;
+	if(settings->dedupeMs > 0)
+	{
+		if(!DedupeOpen(settings->dedupeMs))
+			ErrorExit("Can not make duplicate window");
+		sourceDedupe = TRUE;
+	}
+
+	// Start the readers
+	sourcesStop = FALSE;
+	for(i = 0; i < sourceCount; i++)
+	{
+		atomic_add(&sourcesRunning, 1);
+		if(thread_create(&sources[i].thread, NULL, SourceThread, &sources[i]))
+			ErrorExit("Can not start source thread");
+		sources[i].started = TRUE;
+	}
+	return TRUE;
+}
+
+void SourcesClose(void)
+{
+	unsigned char i;
+	if(sources == NULL) return;
+	sourcesStop = TRUE;
+	for(i = 0; i < sourceCount; i++)
+	{
+		if(sources[i].started)
+			thread_join(sources[i].thread, NULL);
+	}
+	for(i = 0; i < sourceCount; i++)
+	{
+		if(sources[i].opened)
+			CloseTransport(&sources[i].settings);
+	}
+	// Anything still queued or held is passed on
+	if(sourceHandler != NULL)
+	{
+		unsigned char unit[BINARY_DATA_UNIT_SIZE];
+		while(QueuePop(&sourceQueue, unit))
+			SourceUnit(unit, 0);
+		if(sourceDedupe)
+			DedupeExpire(0, sourceHandler);
+	}
+	if(sourceDedupe)
+		DedupeClose();
+	sourceDedupe = FALSE;
+	sourceHandler = NULL;
+	free(sources);
+	sources = NULL;
+	sourceCount = 0;
+	QueueFree(&sourceQueue);
+}
+
+int SourcesWaitFd(void)
+{
+	return sourceQueue.signalFd;
+}
+
+int SourcesTasks(Settings_t* settings, int (*handler)(unsigned char* unit))
+{
+	unsigned char unit[BINARY_DATA_UNIT_SIZE];
+	unsigned long long now = 0;
+	unsigned long running;
+	int count, expired = 0;
+
+	// Read before draining, readers push everything before they stop
+	running = atomic_load_acquire(&sourcesRunning);
+	sourceHandler = handler;
+	if(sourceDedupe) now = MillisecondsEpoch();
+	// Clear the wake up first so units queued while draining signal again
+	QueueClearSignal(&sourceQueue);
+	for(count = 0; count < SOURCE_QUEUE_UNITS && QueuePop(&sourceQueue, unit); count++)
+		SourceUnit(unit, now);
+	// Held units with no more copies to come
+	if(sourceDedupe)
+		expired = DedupeExpire((running == 0 && count == 0) ? 0 : now, handler);
+
+	if(count == 0)
+	{
+		if(running == 0)
+		{
+			// All inputs closed
+			gStatus.app_state = ERROR_STATE;
+		}
+		else if(settings->readTimeout)
+		{
+			// Polled, don't spin
+			usleep(settings->readTimeout * 1000);
+		}
+	}
+	return count + expired;
+}
+
+//EOF
@@ -0,0 +1,18 @@
+// Multiple inputs, each read on its own thread and merged into one stream
+#ifndef _SOURCES_H_
+#define _SOURCES_H_
+
+#include "Config.h"
+
+// Prototypes
+// Open every descriptor in settings->inputs and start a reader thread for each
+int SourcesOpen(Settings_t* settings);
+// Stop the readers and close their inputs
+void SourcesClose(void);
+// Descriptor signalled when units are queued, -1 if the queue has to be polled
+int SourcesWaitFd(void);
+// Pass queued units to the handler in arrival order, copies from several receivers merged, returns the number handled
+int SourcesTasks(Settings_t* settings, int (*handler)(unsigned char* unit));
+
+#endif
+//EOF
@@ -0,0 +1,59 @@
+// Cross-platform thread and mutex alternatives
+#ifndef _THREADS_H_
+#define _THREADS_H_
+
+#ifdef _WIN32
+
+	#include <windows.h>
+
+    /* Thread */
+	#define thread_t HANDLE
+    #define thread_create(thread, attr_ignored, start_routine, arg) ((*(thread) = CreateThread(attr_ignored, 0, start_routine, arg, 0, NULL)) == NULL)
+    #define thread_join(thread, value_ptr_ignored) ((value_ptr_ignored), WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0)
+    #define thread_cancel(thread) (TerminateThread(thread, -1) == 0)
+    #define thread_return_t DWORD WINAPI
+    #define thread_return_value(value) ((unsigned int)(value))
+
+    /* Mutex */
+	#define mutex_t HANDLE
+    #define mutex_init(mutex, attr_ignored) ((*(mutex) = CreateMutex(attr_ignored, FALSE, NULL)) == NULL)
+    #define mutex_lock(mutex) (WaitForSingleObject(*(mutex), INFINITE) != WAIT_OBJECT_0)
+    #define mutex_unlock(mutex) (ReleaseMutex(*(mutex)) == 0)
+    #define mutex_destroy(mutex) (CloseHandle(*(mutex)) == 0)
+
+    /* Atomics (unsigned long counters, pointer swaps) */
+    #define atomic_load_acquire(ptr) ((unsigned long)InterlockedCompareExchange((volatile LONG*)(ptr), 0, 0))
+    #define atomic_store_release(ptr, value) InterlockedExchange((volatile LONG*)(ptr), (LONG)(value))
+    #define atomic_cas(ptr, expected, desired) (InterlockedCompareExchange((volatile LONG*)(ptr), (LONG)(desired), (LONG)(expected)) == (LONG)(expected))
+    #define atomic_add(ptr, value) InterlockedExchangeAdd((volatile LONG*)(ptr), (LONG)(value))
+    #define atomic_exchange_ptr(ptr, value) InterlockedExchangePointer((PVOID volatile*)(ptr), (PVOID)(value))
+
+#else
+
+    /* Thread */
+    #include <pthread.h>
+    #define thread_t      pthread_t
+    #define thread_create pthread_create
+    #define thread_join   pthread_join
+    #define thread_cancel pthread_cancel
+    typedef void *        thread_return_t;
+    #define thread_return_value(value_ignored) ((void)(value_ignored), NULL)
+
+    /* Mutex */
+	#define mutex_t       pthread_mutex_t
+    #define mutex_init    pthread_mutex_init
+    #define mutex_lock    pthread_mutex_lock
+    #define mutex_unlock  pthread_mutex_unlock
+    #define mutex_destroy pthread_mutex_destroy
+
+    /* Atomics (unsigned long counters, pointer swaps) */
+    #define atomic_load_acquire(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define atomic_store_release(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+    #define atomic_cas(ptr, expected, desired) __sync_bool_compare_and_swap((ptr), (expected), (desired))
+    #define atomic_add(ptr, value) __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+    #define atomic_exchange_ptr(ptr, value) __atomic_exchange_n((ptr), (value), __ATOMIC_ACQ_REL)
+
+#endif
+
+#endif
+//EOF
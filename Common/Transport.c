@@ -2,6 +2,7 @@
 	#define _CRT_SECURE_NO_DEPRECATE
 #else
 	#include <string.h>
+	#include <fcntl.h>
 #endif
 
 #include <stdio.h>
@@ -9,12 +10,16 @@
 #include "Config.h"
 #include "Serial.h"
 #include "UDP.h"
+#include "Sources.h"
 #include "AsciiHex.h"
 #include "SlipUtils.h"
 #include "BaxUtils.h"
 #include "Peripherals/Si44.h"
 #include "BaxRx.h"
 #include "Si44_config.h"
+#include "Filter.h"
+#include "Aggregate.h"
+#include "Columns.h"
 
 // Debug setting
 #undef DEBUG_LEVEL
@@ -25,10 +30,20 @@ static const char* dbg_file = "transport";
 #endif
 #include "Debug.h"
 
+// Globals
+// Input framing used when the caller has not given its own
+static Framer_t transportFramer;
+static unsigned char transportBuffer[FRAMER_BUFFER_SIZE];
+
 // Prototypes
 void EventCB (Si44Event_t* evt);
 void BaxPacketEvent(unsigned char* packedPkt);
 int BaxProcessUnit(unsigned char* packedUnit);
+int BaxProcessUnits(const unsigned char* units, unsigned short count);
+int BaxDecodeUnit(const unsigned char* packedUnit, BaxPacket_t* pkt, unsigned char shared);
+int BaxDecodeUnits(const unsigned char* units, BaxPacket_t* pkts, unsigned char* pass, unsigned short count, unsigned char shared);
+static int BaxFilterPkt(BaxPacket_t* pkt, unsigned char shared);
+int BaxFormatUnit(char* buffer, const unsigned char* packedUnit, BaxPacket_t* pkt);
 
 extern void BaxUnpackPkt(unsigned char* buffer, BaxPacket_t* packet);
 extern void BaxRepackPkt(BaxPacket_t* packet, unsigned char* buffer);
@@ -38,6 +53,14 @@ extern void BaxUnpackSensorVals(BaxPacket_t* packet, BaxSensorPacket_t* sensor);
 int OpenTransport(Settings_t *settings)
 {
 	int ret = FALSE;
+	// Several descriptors, each is read on its own thread
+	if(settings->inputCount > 1)
+		return SourcesOpen(settings);
+	if(settings->framer == NULL)
+	{
+		FramerInit(&transportFramer, settings->encoding, transportBuffer, sizeof(transportBuffer), 0);
+		settings->framer = &transportFramer;
+	}
 	switch(settings->source) {
 		case 'S' : {
 			settings->fd = openport(settings->input, 1, 10);
@@ -46,6 +69,7 @@ int OpenTransport(Settings_t *settings)
 				ErrorExit("Could not open com port %s",settings->input);
 			}
 			settings->inGetc = getcSerial;
+			settings->inRead = readSerial;
 			settings->outPutc = putcSerial;
 			ret = TRUE;
 			break;
@@ -62,10 +86,22 @@ int OpenTransport(Settings_t *settings)
                 settings->inputFile = fopen(settings->input, "rb");
             }
 
+			settings->fd = -1;
 			if(settings->inputFile != NULL)
 			{
 				settings->inGetc = getcFile;
+				settings->inRead = readFile;
 				settings->outPutc = putcFile;
+				// Binary unit files are decoded in place
+				if(settings->format == 'U' && settings->encoding == 'R' && mapFile(settings))
+				{
+					DBG_INFO("\r\nInput file mapped, %lu bytes",(unsigned long)settings->inputMapLen);
+				}
+				// Pipes and stdin are waited on like serial ports
+				else if(streamFile(settings))
+				{
+					DBG_INFO("\r\nInput streamed");
+				}
 				ret = TRUE;
 			}
 			else
@@ -114,12 +150,12 @@ int OpenTransport(Settings_t *settings)
 			{
 				DBG_INFO("\r\nip=%s, mac=%s, un=%s, pw=%s",fields[0],fields[1],fields[2], fields[3]);
 			}
-			gSettings.ipAddress = fields[0];
-			gSettings.destMac = fields[1];
-			gSettings.username = fields[2];
-			gSettings.password = fields[3];
+			settings->ipAddress = fields[0];
+			settings->destMac = fields[1];
+			settings->username = fields[2];
+			settings->password = fields[3];
 			// Open udp connection
-			if(BaxUdpOpen(&gSettings))
+			if(BaxUdpOpen(settings))
 			{
 				DBG_INFO("\r\nUDP open success");
 				ret = 1;
@@ -140,6 +176,11 @@ int OpenTransport(Settings_t *settings)
 int CloseTransport(Settings_t* settings)
 {
 	int ret = FALSE;
+	if(settings->inputCount > 1)
+	{
+		SourcesClose();
+		return TRUE;
+	}
 	switch(settings->source) {
 		case 'S' : {
 			if (settings->fd < 0)
@@ -152,13 +193,20 @@ int CloseTransport(Settings_t* settings)
 		}
 		case 'F' : {
 			if(settings->inputFile == NULL)break;
+#ifndef _WIN32
+			// Streams may be shared with the parent, leave them blocking
+			if(settings->fd >= 0)
+				fcntl(settings->fd, F_SETFL, fcntl(settings->fd, F_GETFL) & ~O_NONBLOCK);
+#endif
+			settings->fd = -1;
+			unmapFile(settings);
 			fclose(settings->inputFile);
 			settings->inputFile = NULL;
 			break;
 		}
 		case 'U' : {
 			DBG_INFO("UDP close");
-			UdpCleanup (&gSettings);
+			UdpCleanup (settings);
 			break;
 		}
 		default :
@@ -213,47 +261,117 @@ int CloseOutput(Settings_t* settings)
 	return ret;
 }
 
-void TransportTasks(Settings_t* settings)
+// Descriptor that can be waited on for input, -1 if the input has to be polled
+int TransportWaitFd(Settings_t* settings)
+{
+	if(settings->inputCount > 1)
+		return SourcesWaitFd();
+	switch(settings->source) {
+		case 'S' : return settings->fd;
+		case 'F' : return settings->fd;	/* Streams only, -1 for regular files */
+		case 'U' : return (int)settings->udpSocket;
+		default : break;
+	}
+	return -1;
+}
+
+// Reads return immediately once the caller waits for input events
+void TransportNoWait(Settings_t* settings)
 {
-	const char* line;
+	settings->readTimeout = 0;
+#ifndef _WIN32
+	if(settings->inputCount <= 1 && (settings->source == 'S' || settings->source == 'F') && settings->fd >= 0)
+		fcntl(settings->fd, F_SETFL, fcntl(settings->fd, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+// Decode a frame of *len bytes into binary, returns the data and sets *len to its length
+// Raw frames are already binary and are returned in place
+unsigned char* TransportDecodeFrame(Settings_t* settings, unsigned char* frame, unsigned int* len, unsigned char* rawData)
+{
+	unsigned int length = 0;
+	/*
+		For streams there are two modes, one is a binary unit of 32 bytes (bax file mode)
+		and the other is the event pass through (raw radio modes).
+	*/
+	if(settings->encoding == 'H')
+	{
+		length = ReadHexToBinary(rawData, (const char*)frame, ((*len / 2) < MAX_BINARY_PACKET_LEN) ? (*len / 2) : MAX_BINARY_PACKET_LEN);
+	}
+	else if (settings->encoding == 'S')
+	{
+		length = SlipDecodeFrame(rawData, frame, (unsigned short)*len, MAX_BINARY_PACKET_LEN);
+	}
+	else if (settings->encoding == 'R')
+	{
+		*len = BINARY_DATA_UNIT_SIZE;
+		return frame;
+	}
+	else
+	{
+		DBG_ERROR("Read mode unknown");
+	}
+	*len = length;
+	return rawData;
+}
+
+// Flush live output once per batch of units, file inputs are flushed on close
+static int TransportFlush(Settings_t* settings, int count)
+{
+	if(count > 0 && (settings->source != 'F' || settings->fd >= 0) && gSettings.outputFile != NULL)
+		fflush(gSettings.outputFile);		// Flush to stdout
+	return count;
+}
+
+// Returns the number of frames (or units) handled, 0 if no input was ready
+int TransportTasks(Settings_t* settings)
+{
+	unsigned char *frame, *data;
 	// This buffer will encapsulate the data 
 	Si44Event_t event;
 	unsigned char rawData[MAX_BINARY_PACKET_LEN];
-	unsigned short length = 0;
+	unsigned int length = 0;
+	int count;
+
+	// Units merged from the source threads
+	if(settings->inputCount > 1)
+		return TransportFlush(settings, SourcesTasks(settings, BaxProcessUnit));
 
 	// Early out if no reader
-	if(settings->inGetc == NULL) return;
+	if(settings->inGetc == NULL && settings->inRead == NULL) return 0;
+
+	// Udp units are drained in batches through the receive ring
+	if(settings->source == 'U')
+		return TransportFlush(settings, UdpReadUnits(settings, BaxProcessUnit));
 
-	// Get line (or packet) from transport and parse it
-	line = comm_gets(&gSettings);
-	if(line != NULL)
+	// Mapped binary unit files are passed straight to the unit handler in batches
+	if(settings->inputMap != NULL)
 	{
-		/*
-			For streams there are two modes, one is a binary unit of 32 bytes (bax file mode)
-			and the other is the event pass through (raw radio modes).
-		*/
-		if(settings->encoding == 'H')
-		{
-			length = ReadHexToBinary(rawData, line, MAX_BINARY_PACKET_LEN);
-		}
-		else if (settings->encoding == 'S')
-		{
-			length = ReadFromSlip(rawData, line, MAX_BINARY_PACKET_LEN);
-		}
-		else if (settings->encoding == 'R')
-		{
-			memcpy(rawData,line,BINARY_DATA_UNIT_SIZE);
-			length = BINARY_DATA_UNIT_SIZE;
-		}
-		else
+		for(count = 0; count < TRANSPORT_MAP_UNITS_PER_TASK;)
 		{
-			DBG_ERROR("Read mode unknown");
+			size_t left = (settings->inputMapLen - settings->inputMapPos) / BINARY_DATA_UNIT_SIZE;
+			if(left == 0)
+			{
+				// End of file
+				gStatus.app_state = ERROR_STATE;
+				break;
+			}
+			if(left > BAX_DECRYPT_BATCH) left = BAX_DECRYPT_BATCH;
+			left = BaxProcessUnits(&settings->inputMap[settings->inputMapPos], (unsigned short)left);
+			settings->inputMapPos += left * BINARY_DATA_UNIT_SIZE;
+			count += (int)left;
 		}
+		return count;
 	}
 
-	// Pass on none zero length events
-	if(length > 0)
+	// Frames (or packets) from the transport, everything complete in the buffer is parsed
+	frame = FramerGet(settings->framer, settings, &length);
+	for(count = 0; frame != NULL; count++, frame = FramerNext(settings->framer, &length))
 	{
+		data = TransportDecodeFrame(settings, frame, &length, rawData);
+
+		// Pass on none zero length events
+		if(length == 0) continue;
 		DBG_INFO("\r\nNew event read %u bytes",length);
 		/*
 			If we are reading a file we need to output the data
@@ -267,18 +385,18 @@ void TransportTasks(Settings_t* settings)
 			if(length != BINARY_DATA_UNIT_SIZE) 
 			{
 				DBG_ERROR("Binary unit not 32 bytes?");
-				return;
+				continue;
 			}
 			// Process unit with packet handler
-			BaxProcessUnit(rawData);
+			BaxProcessUnit(data);
 		}
 		// Otherwise the binary data is the event but needs reforming to be safe (non-aligned structs)
 		else if (settings->format == 'E')
 		{
-			event.type = rawData[0];
-			event.err = rawData[1];
-			event.len = rawData[2];
-			event.data = &rawData[3]; 	
+			event.type = data[0];
+			event.err = data[1];
+			event.len = data[2];
+			event.data = &data[3]; 	
 			// Process event with radio handler, may forward to pkt handler
 			EventCB(&event);		
 		}
@@ -292,7 +410,7 @@ void TransportTasks(Settings_t* settings)
 
 	// Input from transport (TODO)
 	
-	return;
+	return TransportFlush(settings, count);
 }
 
 void TransportCheckHardware(void)
@@ -405,6 +523,7 @@ void BaxPacketEvent(unsigned char* packedPkt)
 	DateTime timestamp;
 	char buffer[SERIAL_WRITE_BUFFER_SIZE];
 	BaxPacket_t pkt;
+	unsigned char decoded;
 
 	// Check the data length and data
 	if(packedPkt == NULL) return;
@@ -420,13 +539,21 @@ void BaxPacketEvent(unsigned char* packedPkt)
 	// Unpack packet to readable type and allow decryption to work
 	BaxUnpackPkt(packedPkt, &pkt);	
 
+	// Drop on the header before decrypting, sensor packets are checked as if they
+	// do not decrypt (negative type) which passes anything decrypting would
+	if(pkt.pktType == (signed char)DECODED_BAX_PKT || pkt.pktType == (signed char)DECODED_BAX_PKT_PIR || pkt.pktType == (signed char)DECODED_BAX_PKT_SW)
+		buffer[BAX_OFFSET_BINARY_UNIT+BAX_FIELD_OS_pktType] = (char)-pkt.pktType;
+	if(!FilterUnit((unsigned char*)buffer)) return;
+
 	// Switch on pkt type
 	switch(pkt.pktType){
 		case (unsigned char)DECODED_BAX_PKT : 
 		case (unsigned char)DECODED_BAX_PKT_PIR : 
 		case (unsigned char)DECODED_BAX_PKT_SW : {
-			// Try decrypt
-			if(BaxDecodePkt(&pkt))
+			// Try decrypt, packet ids heard already go no further
+			decoded = BaxDecodePkt(&pkt);
+			if(decoded == BAX_PKT_DUPLICATE) return;
+			if(decoded)
 			{
 				DBG_INFO("\r\nDECODED BAX SENSOR PKT");
 				// Re-pack decrypted pkt
@@ -435,10 +562,8 @@ void BaxPacketEvent(unsigned char* packedPkt)
 			}
 			else
 			{
-				signed char* type = (signed char*)buffer+BAX_OFFSET_BINARY_UNIT+BAX_FIELD_OS_pktType;
+				// Not decrypted, leave payload alone, the type is already negated
 				DBG_INFO("\r\nENCRYPTED BAX SENSOR PKT");
-				// Not decrypted, leave payload alone, negate type
-				*type = -(*type);
 				break;
 			}
 		}
@@ -480,45 +605,152 @@ int BaxProcessUnit(unsigned char* packedUnit)
 {
 	int outLen = 0, sent = 0;
 	BaxPacket_t pkt;
-	BaxSensorPacket_t sensor;
-
 	char buffer[SERIAL_WRITE_BUFFER_SIZE];
 	// Checks 
 	if(packedUnit == NULL) return 0;
 
-	// Check how filtering options apply...
-	BaxUnpackPkt(packedUnit + BAX_OFFSET_BINARY_UNIT, &pkt);	
+	// Decrypt and apply filtering options
+	if(!BaxDecodeUnit(packedUnit, &pkt, FALSE)) return 0;
+
+	// Send data out to caller in correct mode
+	outLen = BaxFormatUnit(buffer, packedUnit, &pkt);
+	if(outLen > 0)
+		sent = fwrite(buffer,sizeof(char),outLen,gSettings.outputFile);
+
+	// Check
+	if(outLen != sent)
+	{
+		DBG_ERROR("Output write error");
+		return -1;
+	}
+	return sent;
+}
+
+// Process up to BAX_DECRYPT_BATCH units with their packets decrypted together, returns the number used
+// A pairing or name packet that adds to the device table is processed on its own
+int BaxProcessUnits(const unsigned char* units, unsigned short count)
+{
+	BaxPacket_t pkts[BAX_DECRYPT_BATCH];
+	unsigned char pass[BAX_DECRYPT_BATCH];
+	char buffer[SERIAL_WRITE_BUFFER_SIZE];
+	unsigned short i, n;
+	int outLen;
+
+	if(count > BAX_DECRYPT_BATCH) count = BAX_DECRYPT_BATCH;
+	for(n = 0; n < count; n++)
+	{
+		if((gSettings.linkMode & LINK_FLAG_ADD) && IS_INFO_UNIT(units + (n * BINARY_DATA_UNIT_SIZE))) break;
+	}
+	if(n == 0)
+	{
+		BaxProcessUnit((unsigned char*)units);
+		return 1;
+	}
+
+	BaxDecodeUnits(units, pkts, pass, n, FALSE);
+	for(i = 0; i < n; i++)
+	{
+		if(!pass[i]) continue;
+		outLen = BaxFormatUnit(buffer, units + (i * BINARY_DATA_UNIT_SIZE), &pkts[i]);
+		if(outLen > 0 && fwrite(buffer,sizeof(char),outLen,gSettings.outputFile) != (size_t)outLen)
+		{
+			DBG_ERROR("Output write error");
+		}
+	}
+	return n;
+}
+
+// Unpack and decrypt a unit, returns TRUE if it passes the filter settings
+// Shared callers (worker threads) only read the device table and unknown address cache
+int BaxDecodeUnit(const unsigned char* packedUnit, BaxPacket_t* pkt, unsigned char shared)
+{
+	// Drop on the header first, then check how filtering options apply...
+	if(!FilterUnit(packedUnit)) return FALSE;
+	BaxUnpackPkt((unsigned char*)packedUnit + BAX_OFFSET_BINARY_UNIT, pkt);	
 	// Try decoding encrypted pkts using receiver function
-	if((unsigned char)pkt.pktType > (unsigned char)ENCRYPTED_PKT_TYPE_OFFSET)
+	if((unsigned char)pkt->pktType > (unsigned char)ENCRYPTED_PKT_TYPE_OFFSET)
 	{
+		unsigned char decoded = shared ? BaxDecryptPkt(pkt) : BaxDecodePktAt(pkt, UnpackLE32((unsigned char*)packedUnit, 4));
 		// If decoded, set type to decoded
-		if(BaxDecodePkt(&pkt)) 
+		if(decoded) 
 		{
-			pkt.pktType = (unsigned char)-pkt.pktType;
+			pkt->pktType = (unsigned char)-pkt->pktType;
 		}
+		// Packet ids heard already go no further
+		if(decoded == BAX_PKT_DUPLICATE) return FALSE;
 	}
-	switch(pkt.pktType){
+	return BaxFilterPkt(pkt, shared);
+}
+
+// As BaxDecodeUnit for up to BAX_DECRYPT_BATCH units, pass[] is set for those passing the filter
+// Without shared the caller must not include pairing or name packets that add to the device table
+int BaxDecodeUnits(const unsigned char* units, BaxPacket_t* pkts, unsigned char* pass, unsigned short count, unsigned char shared)
+{
+	BaxPacket_t* encrypted[BAX_DECRYPT_BATCH];
+	DateTime times[BAX_DECRYPT_BATCH];
+	unsigned char decoded[BAX_DECRYPT_BATCH];
+	unsigned short i, n = 0;
+
+	if(count > BAX_DECRYPT_BATCH) count = BAX_DECRYPT_BATCH;
+	for(i = 0; i < count; i++)
+	{
+		// Units dropped on the header are not unpacked or decrypted, only their type is set
+		pass[i] = (unsigned char)FilterUnit(units + (i * BINARY_DATA_UNIT_SIZE));
+		if(!pass[i])
+		{
+			pkts[i].pktType = (signed char)units[(i * BINARY_DATA_UNIT_SIZE) + BAX_OFFSET_BINARY_UNIT + BAX_FIELD_OS_pktType];
+			continue;
+		}
+		BaxUnpackPkt((unsigned char*)units + (i * BINARY_DATA_UNIT_SIZE) + BAX_OFFSET_BINARY_UNIT, &pkts[i]);
+		if((unsigned char)pkts[i].pktType > (unsigned char)ENCRYPTED_PKT_TYPE_OFFSET)
+		{
+			times[n] = UnpackLE32((unsigned char*)units + (i * BINARY_DATA_UNIT_SIZE), 4);
+			encrypted[n++] = &pkts[i];
+		}
+	}
+	// Decrypt together, set type to decoded
+	if(shared)	BaxDecryptPkts(encrypted, n, decoded);
+	else		BaxDecodePkts(encrypted, times, n, decoded);
+	for(i = 0; i < n; i++)
+	{
+		if(decoded[i])
+			encrypted[i]->pktType = (unsigned char)-encrypted[i]->pktType;
+		// Packet ids heard already go no further
+		if(decoded[i] == BAX_PKT_DUPLICATE)
+			pass[encrypted[i] - pkts] = FALSE;
+	}
+	for(i = 0; i < count; i++)
+	{
+		if(pass[i]) pass[i] = (unsigned char)BaxFilterPkt(&pkts[i], shared);
+	}
+	return count;
+}
+
+// Apply the filter settings to an unpacked packet, returns TRUE if it is to be output
+static int BaxFilterPkt(BaxPacket_t* pkt, unsigned char shared)
+{
+	switch(pkt->pktType){
 		case (unsigned char)AES_KEY_PKT_TYPE : {
-			if(gSettings.linkMode & (unsigned char)LINK_FLAG_ADD)
+			if(!shared && (gSettings.linkMode & (unsigned char)LINK_FLAG_ADD))
 			{
-				BaxInfoPktDetected(&pkt);
+				BaxInfoPktDetected(pkt);
 			}
 			if(!(gSettings.filter & (unsigned char)FILTER_FLAG_PAIRING))
 			{
 				// Not sending pairing packets
-				return 0;
+				return FALSE;
 			}
 			break;
 		}
 		case (unsigned char)BAX_NAME_PKT : {
-			if(gSettings.linkMode & (unsigned char)LINK_FLAG_ADD)
+			if(!shared && (gSettings.linkMode & (unsigned char)LINK_FLAG_ADD))
 			{
-				BaxInfoPktDetected(&pkt);
+				BaxInfoPktDetected(pkt);
 			}
 			if(!(gSettings.filter & (unsigned char)FILTER_FLAG_NAME))
 			{
 				// Not sending pairing name
-				return 0;
+				return FALSE;
 			}
 			break;
 		}
@@ -528,7 +760,7 @@ int BaxProcessUnit(unsigned char* packedUnit)
 			if(!(gSettings.filter & (unsigned char)FILTER_FLAG_DECODED))
 			{
 				// Not sending decoded pkts
-				return 0;
+				return FALSE;
 			}
 			break;
 		}
@@ -539,7 +771,7 @@ int BaxProcessUnit(unsigned char* packedUnit)
 			if(!(gSettings.filter & (unsigned char)FILTER_FLAG_RAW))
 			{
 				// Not sending raw data pkts
-				return 0;
+				return FALSE;
 			}
 			break;
 		}
@@ -547,60 +779,76 @@ int BaxProcessUnit(unsigned char* packedUnit)
 			if(!(gSettings.filter & (unsigned char)FILTER_FLAG_ENCRYPTED))
 			{
 				// Not sending decoded pkts
-				return 0;
+				return FALSE;
 			}
 			break;
 		}
 	}// Packet type switch
 
-	// Send data out to caller in correct mode
+	return TRUE;
+}
+
+// Format a decoded unit in the output mode, returns the length written to buffer
+int BaxFormatUnit(char* buffer, const unsigned char* packedUnit, BaxPacket_t* pkt)
+{
+	int outLen = 0;
+	BaxSensorPacket_t sensor;
+	char hex[(BAX_PKT_DATA_LEN * 2) + 1];
+
 	switch(gSettings.outMode) {
 		case 'R' : {
 			// Raw binary hex mode
-			sent = fwrite(packedUnit,sizeof(char),BINARY_DATA_UNIT_SIZE,gSettings.outputFile);
+			memcpy(buffer,packedUnit,BINARY_DATA_UNIT_SIZE);
+			outLen = BINARY_DATA_UNIT_SIZE;
 			break;
 		}
 		case 'H' : {
 			// Encode into ascii hex
-			outLen = WriteBinaryToHex(buffer, packedUnit, BINARY_DATA_UNIT_SIZE, FALSE);
-			// Write
-			sent = fwrite(buffer,sizeof(char),outLen,gSettings.outputFile);
-			outLen += 2;
-			sent += fwrite("\r\n",sizeof(char),2,gSettings.outputFile);
-			
+			outLen = WriteBinaryToHex(buffer, (unsigned char*)packedUnit, BINARY_DATA_UNIT_SIZE, FALSE);
+			buffer[outLen++] = '\r';
+			buffer[outLen++] = '\n';
 			break;
 		}
 		case 'S' : {
 			// Encode as slip
 			buffer[0] = SLIP_START_OF_PACKET;
-			outLen = WriteToSlip((unsigned char*) &(buffer[1]), packedUnit, BINARY_DATA_UNIT_SIZE, FALSE);
+			outLen = WriteToSlip((unsigned char*) &(buffer[1]), (unsigned char*)packedUnit, BINARY_DATA_UNIT_SIZE, SERIAL_WRITE_BUFFER_SIZE - 2);
 			buffer[1+outLen] = SLIP_END_OF_PACKET;
-			// Write
 			outLen += 2;
-			sent = fwrite(buffer,sizeof(char),outLen,gSettings.outputFile);
-
+			break;
+		}
+		case 'A' : {
+			// Aggregates only, written as their windows close
+			AggregateUnit(packedUnit, pkt);
+			outLen = 0;
+			break;
+		}
+		case 'B' : {
+			// Column blocks, written as they fill
+			ColumnsUnit(packedUnit, pkt);
+			outLen = 0;
 			break;
 		}
 		case 'C' : {
 			// CSV output
-			//sent += fprintf(gSettings.outputFile,"%lu,",UnpackLE32(packedUnit, 0));			// Data number
-			sent = fprintf(gSettings.outputFile,"%s,",RtcToString(UnpackLE32(packedUnit,4)));	// Date, Time
-			WriteBinaryToHex(buffer, packedUnit+BAX_OFFSET_BINARY_UNIT, 4, TRUE);				// Address (big endian print)
-			sent += fprintf(gSettings.outputFile,"%s,",buffer);
-			sent += fprintf(gSettings.outputFile,"%d,%d,",RssiTodBm(pkt.rssi), pkt.pktType);
+			//outLen += sprintf(buffer+outLen,"%lu,",UnpackLE32(packedUnit, 0));			// Data number
+			outLen = sprintf(buffer,"%s,",RtcToStringBuffer(UnpackLE32((unsigned char*)packedUnit,4),hex));	// Date, Time
+			WriteBinaryToHex(hex, (unsigned char*)packedUnit+BAX_OFFSET_BINARY_UNIT, 4, TRUE);				// Address (big endian print)
+			outLen += sprintf(buffer+outLen,"%s,",hex);
+			outLen += sprintf(buffer+outLen,"%d,%d,",RssiTodBm(pkt->rssi), pkt->pktType);
 
-			switch(pkt.pktType){
+			switch(pkt->pktType){
 				case (unsigned char)DECODED_BAX_PKT : 
 				case (unsigned char)DECODED_BAX_PKT_PIR : 
 				case (unsigned char)DECODED_BAX_PKT_SW : {
-					BaxUnpackSensorVals(&pkt, &sensor);
-					sent += fprintf(gSettings.outputFile,"%u,%d,%u,%u.%02u,",
+					BaxUnpackSensorVals(pkt, &sensor);
+					outLen += sprintf(buffer+outLen,"%u,%d,%u,%u.%02u,",
 						sensor.pktId, 			// pktId
 						sensor.xmitPwrdBm, 		// txPwr dbm
 						sensor.battmv, 			// battmv
 						sensor.humidSat >> 8, 	// humidSat MSB
 						(((signed short)39*(sensor.humidSat & 0xff))/100));// humidSat LSB
-					sent += fprintf(gSettings.outputFile,"%d,%u,%u,%u,%u\r\n",
+					outLen += sprintf(buffer+outLen,"%d,%u,%u,%u,%u\r\n",
 						sensor.tempCx10,			// tempCx10
 						sensor.lightLux, 			// lightLux
 						sensor.pirCounts,			// pirCounts
@@ -609,49 +857,48 @@ int BaxProcessUnit(unsigned char* packedUnit)
 					break;
 				}
 				case (unsigned char)PACKET_TYPE_RAW_UINT8_x14 : {
-					const unsigned char* val = &pkt.data[2];
-					sent += fprintf(gSettings.outputFile,"%d,%d,",pkt.data[0],pkt.data[1]);				// pktId, txPwr
-					sent += fprintf(gSettings.outputFile,"%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\r\n",
+					const unsigned char* val = &pkt->data[2];
+					outLen += sprintf(buffer+outLen,"%d,%d,",pkt->data[0],pkt->data[1]);				// pktId, txPwr
+					outLen += sprintf(buffer+outLen,"%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\r\n",
 									val[0],val[1],val[2],val[3],val[4],val[5],val[6],
 									val[7],val[8],val[9],val[10],val[11],val[12],val[13]);
 					break;
 				}
 				case (unsigned char)PACKET_TYPE_RAW_SINT8_x14 : {
-					const signed char* val = (const signed char*)&pkt.data[2];
-					sent += fprintf(gSettings.outputFile,"%d,%d,",pkt.data[0],pkt.data[1]);				// pktId, txPwr
-					sent += fprintf(gSettings.outputFile,"%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\r\n",
+					const signed char* val = (const signed char*)&pkt->data[2];
+					outLen += sprintf(buffer+outLen,"%d,%d,",pkt->data[0],pkt->data[1]);				// pktId, txPwr
+					outLen += sprintf(buffer+outLen,"%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\r\n",
 									val[0],val[1],val[2],val[3],val[4],val[5],val[6],
 									val[7],val[8],val[9],val[10],val[11],val[12],val[13]);
 					break;
 				}
 				case (unsigned char)PACKET_TYPE_RAW_UINT16_x7 : {
-					const unsigned char* b = &pkt.data[2];
+					const unsigned char* b = &pkt->data[2];
 					unsigned short i, val[7];
-					sent += fprintf(gSettings.outputFile,"%d,%d,",RssiTodBm(pkt.rssi), pkt.pktType);	// RSSI, pktType,
-					sent += fprintf(gSettings.outputFile,"%d,%d,",pkt.data[0],pkt.data[1]);				// pktId, txPwr
+					outLen += sprintf(buffer+outLen,"%d,%d,",RssiTodBm(pkt->rssi), pkt->pktType);	// RSSI, pktType,
+					outLen += sprintf(buffer+outLen,"%d,%d,",pkt->data[0],pkt->data[1]);				// pktId, txPwr
 					// Unpack shorts
 					for(i=0;i<7;i++){val[i] = UnpackLE16((unsigned char*)b, (i*2));}
-					sent += fprintf(gSettings.outputFile,"%u,%u,%u,%u,%u,%u,%u\r\n",val[0],val[1],val[2],val[3],val[4],val[5],val[6]);
+					outLen += sprintf(buffer+outLen,"%u,%u,%u,%u,%u,%u,%u\r\n",val[0],val[1],val[2],val[3],val[4],val[5],val[6]);
 					break;
 				}
 				case (unsigned char)PACKET_TYPE_RAW_SINT16_x7 : {
-					const unsigned char* b = &pkt.data[2];
+					const unsigned char* b = &pkt->data[2];
 					signed short i, val[7];
-					sent += fprintf(gSettings.outputFile,"%d,%d,",RssiTodBm(pkt.rssi), pkt.pktType);	// RSSI, pktType,
-					sent += fprintf(gSettings.outputFile,"%d,%d,",pkt.data[0],pkt.data[1]);				// pktId, txPwr
+					outLen += sprintf(buffer+outLen,"%d,%d,",RssiTodBm(pkt->rssi), pkt->pktType);	// RSSI, pktType,
+					outLen += sprintf(buffer+outLen,"%d,%d,",pkt->data[0],pkt->data[1]);				// pktId, txPwr
 					// Unpack shorts
 					for(i=0;i<7;i++){val[i] = (signed short)UnpackLE16((unsigned char*)b, (i*2));}
-					sent += fprintf(gSettings.outputFile,"%d,%d,%d,%d,%d,%d,%d\r\n",val[0],val[1],val[2],val[3],val[4],val[5],val[6]);
+					outLen += sprintf(buffer+outLen,"%d,%d,%d,%d,%d,%d,%d\r\n",val[0],val[1],val[2],val[3],val[4],val[5],val[6]);
 					break;
 				}
 				default : {
 					// Raw binary
-					WriteBinaryToHex(buffer, pkt.data, BAX_PKT_DATA_LEN, FALSE);				// Raw undecoded packets
-					sent += fprintf(gSettings.outputFile,"%s\r\n",buffer);
+					WriteBinaryToHex(hex, pkt->data, BAX_PKT_DATA_LEN, FALSE);				// Raw undecoded packets
+					outLen += sprintf(buffer+outLen,"%s\r\n",hex);
 					break;
 				}
 			}
-			outLen = sent; // Prevent next check showing error
 			break;
 		}
 		default : {
@@ -660,13 +907,5 @@ int BaxProcessUnit(unsigned char* packedUnit)
 		}
 	}
 	
-	fflush(gSettings.outputFile);		// Flush to stdout
-
-	// Check
-	if(outLen != sent)
-	{
-		DBG_ERROR("Output write error");
-		return -1;
-	}
-	return sent;
+	return outLen;
 }
@@ -34,21 +34,6 @@
 	#define socketErrno   (WSAGetLastError())
 	#define SOCKET_EWOULDBLOCK WSAEWOULDBLOCK
 
-    /* Thread */
-	#define thread_t HANDLE
-    #define thread_create(thread, attr_ignored, start_routine, arg) ((*(thread) = CreateThread(attr_ignored, 0, start_routine, arg, 0, NULL)) == NULL)
-    #define thread_join(thread, value_ptr_ignored) ((value_ptr_ignored), WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0)
-    #define thread_cancel(thread) (TerminateThread(thread, -1) == 0)
-    #define thread_return_t DWORD WINAPI
-    #define thread_return_value(value) ((unsigned int)(value))
-
-    /* Mutex */
-	#define mutex_t HANDLE
-    #define mutex_init(mutex, attr_ignored) ((*(mutex) = CreateMutex(attr_ignored, FALSE, NULL)) == NULL)
-    #define mutex_lock(mutex) (WaitForSingleObject(*(mutex), INFINITE) != WAIT_OBJECT_0)
-    #define mutex_unlock(mutex) (ReleaseMutex(*(mutex)) == 0)
-    #define mutex_destroy(mutex) (CloseHandle(*(mutex)) == 0)
-
     /* Device discovery */
     #include <setupapi.h>
     #ifdef _MSC_VER
@@ -59,6 +44,11 @@
 
 #else
 
+	/* recvmmsg */
+	#ifdef __linux__
+		#define _GNU_SOURCE
+	#endif
+
     /* Sockets */
 	#include <sys/ioctl.h>
     #include <unistd.h>
@@ -79,22 +69,6 @@
 	#define socketStrerr(_e) strerror(_e)
 	#define SOCKET_EWOULDBLOCK EWOULDBLOCK
 
-    /* Thread */
-    #include <pthread.h>
-    #define thread_t      pthread_t
-    #define thread_create pthread_create
-    #define thread_join   pthread_join
-    #define thread_cancel pthread_cancel
-    typedef void *        thread_return_t;
-    #define thread_return_value(value_ignored) ((value_ignored), NULL)
-
-    /* Mutex */
-	#define mutex_t       pthread_mutex_t
-    #define mutex_init    pthread_mutex_init
-    #define mutex_lock    pthread_mutex_lock
-    #define mutex_unlock  pthread_mutex_unlock
-    #define mutex_destroy pthread_mutex_destroy
-
 #endif
 
 
@@ -108,6 +82,7 @@
 #include <time.h>
 #include <sys/timeb.h>
 #include <sys/stat.h>
+#include "Threads.h"
 
 #include "UDP.h"
 #include "AsciiHex.h"
@@ -128,6 +103,18 @@ unsigned char BaxUdpAutoDiscovery(Settings_t* settings, unsigned short timeout);
 unsigned char BaxUdpConnect(Settings_t* settings);
 unsigned char* UdpWaitOnPkt(SOCKET s, struct sockaddr_in *serverAddr, int* count, int timeoutms);
 
+// Receive ring, datagrams are read in batches and handed out as whole units
+typedef struct {
+	unsigned char slot[UDP_RING_SLOTS][UDP_RING_SLOT_SIZE];
+	unsigned short len[UDP_RING_SLOTS];
+	unsigned short head;	/* Free running write count */
+	unsigned short tail;	/* Free running read count */
+#ifdef __linux__
+	struct mmsghdr msgs[UDP_RING_SLOTS];
+	struct iovec iov[UDP_RING_SLOTS];
+#endif
+} UdpRing_t;
+
 #define MAX_IP_P_ADD_LEN (16+6+1) //aaa.aaa.aaa.aaa:ppppp null
 typedef struct {
 	unsigned char petition[PETITION_LEN];
@@ -141,12 +128,21 @@ typedef struct {
 	uint32_t sessionTimout;
 	uint32_t leaseLen;
 	unsigned long long start;
+	UdpRing_t ring;
 } BaxDiscInfo_t;
 
+// Session renewal shares the UdpWaitOnPkt buffer, one router at a time
+static mutex_t udpSessionMutex;
+static unsigned char udpSessionMutexInit = FALSE;
+
 size_t strcpytok(char* dest, const char* source, const char* tokens);
 size_t strskiptok(const char* source, const char* tokens);
 size_t strfindtok(const char* source, const char* tokens);
 
+static void UdpRingInit(UdpRing_t* ring);
+static int UdpRingFill(SOCKET s, UdpRing_t* ring);
+static void UdpSetReceiveBuffer(SOCKET s, int size);
+
 uint64_t ReadMacIEEE(unsigned char* dest, char* source)
 {
 	uint64_t ret = 0;
@@ -249,6 +245,12 @@ unsigned char BaxUdpOpen(Settings_t* settings)
 		return 0;
 	}
 	memset(settings->udpState,0,sizeof(BaxDiscInfo_t));
+	UdpRingInit(&((BaxDiscInfo_t*)settings->udpState)->ring);
+	if(!udpSessionMutexInit)
+	{
+		mutex_init(&udpSessionMutex, NULL);
+		udpSessionMutexInit = TRUE;
+	}
 
 	// Make settings correct
 	settings->encoding = 'R'; // Raw binary units
@@ -280,12 +282,15 @@ unsigned char BaxUdpOpen(Settings_t* settings)
 		remote->sin_addr.s_addr = inet_addr(settings->ipAddress);
 		remote->sin_port = htons(settings->udpPort);
 		// Open the incoming udp socket
-		settings->udpSocket = opensocket(NULL, BAX_UDP_PORT_FORWARDING,  (struct sockaddr_in *)settings->localServer);
+		settings->udpSocket = opensocket(NULL, settings->udpLocalPort,  (struct sockaddr_in *)settings->localServer);
 		if(settings->udpSocket == SOCKET_ERROR || settings->udpSocket == INVALID_SOCKET)
 		{
 			DBG_ERROR("Can not make udp socket");
 			return 0;
 		}
+		// Room for bursts from the router
+		if(settings->udpRcvBuf > 0)
+			UdpSetReceiveBuffer(settings->udpSocket, settings->udpRcvBuf);
 		ret = BaxUdpConnect(settings);
 	}
 	return  ret;
@@ -428,6 +433,7 @@ unsigned char BaxUdpConnect(Settings_t* settings)
 				DBG_INFO("\r\nUdp negotiation success");
 				info->start = MillisecondsEpoch();
 				settings->inGetc = getcUdp;
+				settings->inRead = readUdp;
 				settings->outPutc = putcUdp;
 				ret = 1;
 				break;
@@ -443,12 +449,32 @@ unsigned char BaxUdpConnect(Settings_t* settings)
 	return ret;
 }
 
+// Renew the router session before its lease runs out
+void UdpCheckSession(Settings_t* settings)
+{
+	BaxDiscInfo_t* info = (BaxDiscInfo_t*)settings->udpState;
+	unsigned long long milliseconds, now = MillisecondsEpoch();
+	if(info == NULL) return;
+
+	// Check timouts
+	milliseconds = now - info->start;
+	if((milliseconds/1000) > (info->sessionTimout / 2))
+	{
+		// If more than half the session is used, reconnect
+		DBG_INFO("\r\nUdp renegotiating session");
+		mutex_lock(&udpSessionMutex);
+		if(!BaxUdpConnect(settings))
+		{
+			ErrorExit("\r\nUdp reconnection timeout failed");
+		}
+		mutex_unlock(&udpSessionMutex);
+	}
+}
+
 // Shim for api cross compatibility to typedef int (*GetByte_t)(Settings_t* settings);
 int getcUdp(Settings_t* settings)
 {
 	int ret = -1;
-	BaxDiscInfo_t* info = (BaxDiscInfo_t*)settings->udpState;
-	unsigned long long milliseconds, now = MillisecondsEpoch();
 	int length;
 	unsigned char *newUdpPkt;
 	struct sockaddr_in from = {0};
@@ -480,18 +506,27 @@ int getcUdp(Settings_t* settings)
 		}
 	}
 	
-	// Check timouts
-	milliseconds = now - info->start;
-	if((milliseconds/1000) > (info->sessionTimout / 2))
+	UdpCheckSession(settings);
+	return ret;
+}
+// Block reader, typedef int (*ReadBlock_t)(Settings_t* settings, unsigned char* buffer, int maxLen);
+int readUdp(Settings_t* settings, unsigned char* buffer, int maxLen)
+{
+	int ret = 0;
+	int length;
+	unsigned char *newUdpPkt;
+	struct sockaddr_in from = {0};
+
+	// Check for in packets with read timout, whole units only
+	newUdpPkt = UdpWaitOnPkt(settings->udpSocket, &from, &length, settings->readTimeout);
+	if((newUdpPkt != NULL) && (length == BINARY_DATA_UNIT_SIZE) && (length <= maxLen))
 	{
-		// If more than half the session is used, reconnect
-		DBG_INFO("\r\nUdp renegotiating session");
-		if(!BaxUdpConnect(settings))
-		{
-			ErrorExit("\r\nUdp reconnection timeout failed");
-		}
+		DBG_INFO("\r\nUdp element read");
+		memcpy(buffer, newUdpPkt, length);
+		ret = length;
 	}
 
+	UdpCheckSession(settings);
 	return ret;
 }
 // Shim for api cross compatibility to typedef int (*PutByte_t)(Settings_t* settings, unsigned char b);
@@ -504,6 +539,119 @@ int putcUdp(Settings_t* settings, unsigned char b)
 }
 
 
+// Drain the socket through the receive ring, whole units are passed to the handler
+// Returns the number of datagrams taken from the ring
+int UdpReadUnits(Settings_t* settings, int (*handler)(unsigned char* unit))
+{
+	UdpRing_t* ring = &((BaxDiscInfo_t*)settings->udpState)->ring;
+	int taken = 0;
+
+	// Top up the ring, polled callers wait a little if nothing is queued
+	if(UdpRingFill(settings->udpSocket, ring) == 0 && ring->head == ring->tail && settings->readTimeout)
+		usleep(settings->readTimeout * 1000);
+
+	// Hand out whole units only, framed in place in their slots
+	while(ring->tail != ring->head)
+	{
+		unsigned short index = ring->tail++ & (UDP_RING_SLOTS - 1);
+		Framer_t framer;
+		unsigned char* unit;
+		unsigned int len;
+		if(ring->len[index] == 0 || (ring->len[index] % BINARY_DATA_UNIT_SIZE) != 0)
+		{
+			DBG_INFO("\r\nUdp datagram discarded, %u bytes",ring->len[index]);
+			taken++;
+			continue;
+		}
+		FramerInit(&framer, 'R', ring->slot[index], UDP_RING_SLOT_SIZE, ring->len[index]);
+		while((unit = FramerNext(&framer, &len)) != NULL)
+		{
+			unit[BAX_OFFSET_RECEIVERS] |= settings->receiver;
+			handler(unit);
+			taken++;
+		}
+	}
+
+	UdpCheckSession(settings);
+	return taken;
+}
+
+static void UdpRingInit(UdpRing_t* ring)
+{
+	memset(ring, 0, sizeof(UdpRing_t));
+#ifdef __linux__
+	{
+		unsigned short i;
+		for(i = 0; i < UDP_RING_SLOTS; i++)
+		{
+			ring->iov[i].iov_base = ring->slot[i];
+			ring->iov[i].iov_len = UDP_RING_SLOT_SIZE;
+			ring->msgs[i].msg_hdr.msg_iov = &ring->iov[i];
+			ring->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#endif
+}
+
+// Read as many queued datagrams as fit in the free contiguous slots
+static int UdpRingFill(SOCKET s, UdpRing_t* ring)
+{
+	unsigned short start = ring->head & (UDP_RING_SLOTS - 1);
+	unsigned short space = UDP_RING_SLOTS - (unsigned short)(ring->head - ring->tail);
+	int count;
+#ifdef __linux__
+	int i;
+#endif
+
+	if(space > (UDP_RING_SLOTS - start)) space = UDP_RING_SLOTS - start;
+	if(space == 0) return 0;
+#ifdef __linux__
+	// One call for the whole batch
+	count = recvmmsg(s, &ring->msgs[start], space, MSG_DONTWAIT, NULL);
+	if(count < 0)
+	{
+		if(socketErrno != SOCKET_EWOULDBLOCK && socketErrno != EAGAIN && socketErrno != EINTR)
+			ErrorExit("Socket failed error");
+		return 0;
+	}
+	for(i = 0; i < count; i++)
+	{
+		// Oversize datagrams are truncated, mark them for discard
+		if(ring->msgs[start + i].msg_hdr.msg_flags & MSG_TRUNC)
+			ring->len[start + i] = 0;
+		else
+			ring->len[start + i] = ring->msgs[start + i].msg_len;
+	}
+#else
+	for(count = 0; count < space; count++)
+	{
+		int length = recv(s, (char*)ring->slot[start + count], UDP_RING_SLOT_SIZE, 0);
+		if(length < 0 && socketErrno != SOCKET_EWOULDBLOCK)
+			ErrorExit("Socket failed error");
+		if(length <= 0) break;
+		ring->len[start + count] = length;
+	}
+#endif
+	ring->head += count;
+	return count;
+}
+
+static void UdpSetReceiveBuffer(SOCKET s, int size)
+{
+	int actual = 0;
+	socklen_t length = sizeof(actual);
+#ifdef SO_RCVBUFFORCE
+	// Privileged processes may exceed the system limit
+	if(setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, (char*)&size, sizeof(size)) != 0)
+#endif
+	if(setsockopt(s, SOL_SOCKET, SO_RCVBUF, (char*)&size, sizeof(size)) != 0)
+	{
+		DBG_ERROR("Can not set udp receive buffer");
+	}
+	getsockopt(s, SOL_SOCKET, SO_RCVBUF, (char*)&actual, &length);
+	DBG_INFO("\r\nUdp receive buffer %d bytes (requested %d)",actual,size);
+}
+
 unsigned char* UdpWaitOnPkt(SOCKET s, struct sockaddr_in *serverAddr, int* count, int timeoutms)
 {
 	unsigned int size_of_server = sizeof(struct sockaddr_in);
@@ -526,14 +674,14 @@ unsigned char* UdpWaitOnPkt(SOCKET s, struct sockaddr_in *serverAddr, int* count
 		{
 			ErrorExit("Socket failed error");
 		}
-		// Wait for 1ms
-		usleep(1000);
 		// Timeout
 		if(timeoutms-- <= 0)
 		{
 			return NULL;
 			break;
 		}
+		// Wait for 1ms
+		usleep(1000);
 	}
 	return NULL;
 }
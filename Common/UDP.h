@@ -13,6 +13,13 @@ void UdpCleanup (Settings_t* settings);
 // Shim for api cross compatibility to typedef int (*GetByte_t)(Settings_t* settings);
 int putcUdp(Settings_t* settings, unsigned char b);
 int getcUdp(Settings_t* settings);
+// Block reader, typedef int (*ReadBlock_t)(Settings_t* settings, unsigned char* buffer, int maxLen);
+int readUdp(Settings_t* settings, unsigned char* buffer, int maxLen);
+
+// Batched unit reader, drains the socket through the receive ring
+int UdpReadUnits(Settings_t* settings, int (*handler)(unsigned char* unit));
+// Renew the session lease when more than half has been used
+void UdpCheckSession(Settings_t* settings);
 
 /* Hide server struct */
 void* makeServer(void);
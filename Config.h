@@ -25,6 +25,7 @@
 #define LINK_FLAG_FILE	0x01
 #define LINK_FLAG_PAIR	0x02
 #define LINK_FLAG_ADD	0x04
+#define LINK_FLAG_WATCH	0x08
 
 // Filter options
 #define FILTER_FLAG_PAIRING		0x01
@@ -34,15 +35,42 @@
 #define FILTER_FLAG_RAW			0x10
 
 // BAX device memory
-#define MAX_BAX_INFO_ENTRIES 	255
+#define BAX_INFO_DYNAMIC				/* Device table grows as devices are added, see -K for a limit */
+#define BAX_INFO_SLAB_ENTRIES	256		/* Devices allocated at a time */
 #define MAX_BAX_SAVED_PACKETS 	1
 #define MAX_BINARY_PACKET_LEN	256
+#define BAX_DECRYPT_BATCH		64		/* Encrypted packets decrypted together from files */
+#define BAX_INFO_INDEX_SIZE		1024	/* Smallest device lookup hash, doubles to stay over twice the devices (power of 2) */
+#define BAX_UNKNOWN_CACHE_SIZE	1024	/* Unknown addresses remembered (power of 2) */
 #define BAX_DEVICE_INFO_FILE	gSettings.baxInfoFile
+#define BAX_INFO_STORE					/* New records are saved in batches by InfoStore.c */
 #define BAX_RF_SETTINGS_FILE	gSettings.baxConfigFile
 
+// Sources
+#define MAX_INPUT_SOURCES		8		/* Descriptors accepted with repeated -d */
+#define SOURCE_QUEUE_UNITS		4096	/* Units buffered between source threads and the output (power of 2) */
+#define SOURCE_POLL_MS			100		/* Source thread wait before checking for exit */
+#define SOURCE_SIGNAL_UNITS		64		/* Units queued before waking the output */
+#define SOURCE_DEDUPE_MS		100		/* Default window copies from other receivers are merged in */
+#define SOURCE_DEDUPE_UNITS		4096	/* Units held while waiting for copies (power of 2) */
+
 // Reader 
 #define SERIAL_READ_BUFFER_SIZE 256
 #define SERIAL_WRITE_BUFFER_SIZE 256
+#define SERIAL_READ_BLOCK_SIZE	16384	/* Bytes requested per block read from a source */
+#define TRANSPORT_MAP_UNITS_PER_TASK	1024	/* Units decoded per call from a mapped file */
+#define STREAM_PIPE_SIZE		(1024 * 1024)	/* Pipe capacity requested for streamed input (stdin) */
+
+// Aggregate output
+#define AGGREGATE_MAX_WINDOWS	4		/* Window lengths accepted by -W */
+#define AGGREGATE_DEFAULT_S		60		/* Window length if none are given (s) */
+
+// Columnar output
+#define COLUMN_BLOCK_ROWS		65536	/* Units buffered and written as one block of column chunks (power of 2) */
+
+// Main loop
+#define APP_TIMER_PERIOD_MS		1000	/* Periodic tasks interval when waiting on input events */
+#define APP_MAX_EVENTS			4
 
 // Bax init script file reader
 //#define BAX_MAX_FILE_LINE_BUFFER 256
@@ -50,11 +78,15 @@
 // UDP defines
 #define BAX_UDP_PORT_FORWARDING		30303
 #define BAX_UDP_PORT_DISCOVERY		30304
+#define UDP_RING_SLOTS				256		/* Datagrams held in the receive ring (power of 2) */
+#define UDP_RING_SLOT_SIZE			64		/* Larger than a unit so oversize datagrams are seen */
 
 // Types
 struct Settings_tag;
+struct Framer_tag;
 typedef int (*GetByte_t)(struct Settings_tag* settings);
 typedef int (*PutByte_t)(struct Settings_tag* settings, unsigned char b);
+typedef int (*ReadBlock_t)(struct Settings_tag* settings, unsigned char* buffer, int maxLen);
 
 // Generic state type
 typedef enum {
@@ -82,7 +114,15 @@ typedef struct Settings_tag {
 	char format;
 	char encoding;
 	char* input;
+	char* inputs[MAX_INPUT_SOURCES];	/* All descriptors, each read on its own thread if more than one */
+	unsigned char inputCount;
+	unsigned char receiver;		/* Bit set in the units read from this input when merged, 0 if not */
+	unsigned short dedupeMs;	/* Window units heard by several inputs are merged in, 0 to pass every copy */
+	struct Framer_tag* framer;	/* Input framing, set up by OpenTransport if NULL */
 	FILE* inputFile;
+	const unsigned char* inputMap;	/* Memory mapped input file (binary units) */
+	size_t inputMapLen;
+	size_t inputMapPos;
 	// Output
 	char output;
 	char outMode;
@@ -94,15 +134,21 @@ typedef struct Settings_tag {
 	char* baxInfoFile;
 	char* baxInfoFileSetting ;
 	char* baxConfigFile; /* Init script */
+	char* allowFile;	/* Addresses to decode, all if NULL */
+	char* denyFile;		/* Addresses to drop before decrypting */
 	// Reader specific functions
 	PutByte_t outPutc;
 	GetByte_t inGetc;
+	ReadBlock_t inRead;
+	unsigned short readTimeout;	/* Block read wait (ms), 0 when driven by input events */
 	int fd;
 	// UDP specific options
 	void* localServer;
 	void* remoteAddress;
 	SOCKET udpSocket; 
+	int udpRcvBuf;		/* SO_RCVBUF bytes, 0 for the system default */
 	unsigned short udpPort;
+	unsigned short udpLocalPort;	/* Port the router forwards to */
 	void* udpState;
 	char* ipAddress;
 	char* username;
@@ -111,6 +157,17 @@ typedef struct Settings_tag {
 	// Output tracking
 	unsigned long pktCount;
 	unsigned long dataNum;
+	// Offline decoding
+	unsigned short threads;
+	char aesCode;		/* Fastest AES code allowed, 'N'I, 'T'ables or 'B'yte-wise */
+	// Device table
+	unsigned long infoLimit;	/* Devices kept, 0 for no limit */
+	char infoEvict;		/* Device dropped at the limit, 'L'east recently heard or 'O'ldest added */
+	unsigned short historyDepth;	/* Packets kept per device */
+	char* linkFile;		/* Packet id counts written here on exit */
+	// Aggregate output
+	unsigned long windows[AGGREGATE_MAX_WINDOWS];	/* Window lengths (s) for output mode 'A' */
+	unsigned char windowCount;
 } Settings_t;
 
 typedef struct {
@@ -127,7 +184,10 @@ int OpenTransport(Settings_t* settings);
 int CloseTransport(Settings_t* settings);
 int OpenOutput(Settings_t* settings);
 int CloseOutput(Settings_t* settings);
-void TransportTasks(Settings_t* settings);
+int TransportTasks(Settings_t* settings);
+unsigned char* TransportDecodeFrame(Settings_t* settings, unsigned char* frame, unsigned int* len, unsigned char* rawData);
+int TransportWaitFd(Settings_t* settings);
+void TransportNoWait(Settings_t* settings);
 void TransportCheckHardware(void);
 
 // Exit error handler
@@ -11,7 +11,15 @@
 #else
 	#include <ctype.h>
 	#include <string.h>
+	#include <errno.h>
+	#include <unistd.h>
 	#include <curses.h>
+	#ifdef __linux__
+		#include <sys/epoll.h>
+		#include <sys/timerfd.h>
+		#include <termios.h>
+		#include <signal.h>
+	#endif
 	#define _getch getch
 
 	int kbhit(void)
@@ -35,7 +43,15 @@
 //#include "Serial.h"
 //#include "Utils.h"
 #include "BaxRx.h"
+#include "AsciiHex.h"
 #include "Config.h"
+#include "Offline.h"
+#include "InfoStore.h"
+#include "InfoWatch.h"
+#include "Filter.h"
+#include "Aggregate.h"
+#include "Columns.h"
+#include "UDP.h"
 
 // Debug setting
 #undef DEBUG_LEVEL
@@ -64,7 +80,12 @@ const char* CommandLineOptions =
 "                    Hex ascii       'H'                           \r\n"
 "                    Slip encoded    'S'                           \r\n\r\n"
 "    'D'escriptor,   Default: COM1                                 \r\n"
-"    (COM1 , DAT12345.BIN, 192.168.0.100+12-34-56-78-9A-BC+username+password)\r\n\r\n"
+"    (COM1 , DAT12345.BIN, 192.168.0.100+12-34-56-78-9A-BC+username+password)\r\n"
+"    Repeat 'D' to merge serial ports and UDP routers (binary units) \r\n\r\n"
+"    UDP receive 'B'uffer Default: system                          \r\n"
+"                    e.g. 4194304 (bytes)                          \r\n\r\n"
+"    D'U'plicate window, merged inputs Default: 100 (ms)           \r\n"
+"                    e.g. 0 (pass every receiver's copy)           \r\n\r\n"
 "Output options:                                                   \r\n"
 "    'O'utput        Default: stdout                               \r\n"
 "                    File            'F'                           \r\n"
@@ -73,7 +94,11 @@ const char* CommandLineOptions =
 "                    Raw binary      'R'                           \r\n"
 "                    Hex ascii       'H'                           \r\n"
 "                    Slip encoded    'S'                           \r\n"
-"                    CSV output      'C'                           \r\n\r\n"
+"                    CSV output      'C'                           \r\n"
+"                    Aggregates (CSV) 'A'                          \r\n"
+"                    Binary columns  'B'                           \r\n\r\n"
+"    Aggregate 'W'indows Default: 60 (s)                           \r\n"
+"                    e.g. 60,900 (divisors of a day)               \r\n\r\n"
 "    Outpu'T' file   Default: output.out	                       \r\n"
 "                    e.g. output.bin                               \r\n\r\n"
 "Bax settings:                                                     \r\n"
@@ -83,14 +108,32 @@ const char* CommandLineOptions =
 "                    Decrypted       'D'                           \r\n"
 "                    Encrypted       'E'                           \r\n"
 "                    Encrypted       'R'                           \r\n\r\n"
+"    Al'L'owed addresses file  Default: all                        \r\n"
+"    E'X'cluded addresses file Default: none                       \r\n"
+"                    e.g. ALLOW.TXT (hex address per line)         \r\n\r\n"
 "    'R'adio decryption settings    Default: IPF                   \r\n"
 "                    Load info file   'I'                          \r\n"
 "                    Pair new devices 'P'                          \r\n"
-"                    Add to info file 'F'                          \r\n\r\n"
+"                    Add to info file 'F'                          \r\n"
+"                    Reload info file on change 'W'                \r\n\r\n"
+"    'A'ES code      Default: fastest available                    \r\n"
+"                    AES instructions 'N'                          \r\n"
+"                    32-bit tables    'T'                          \r\n"
+"                    Byte-wise        'B'                          \r\n\r\n"
 "    'I'nfo file name Default: BAX_INFO.BIN                        \r\n"
 "                    e.g. BAX_INFO.BIN                             \r\n\r\n"
 "    'C'onfig file name Default: BAX_SETUP.CFG                     \r\n"
-"                    e.g. BAX_SETUP.CFG                            \r\n";
+"                    e.g. BAX_SETUP.CFG                            \r\n\r\n"
+"    'J'obs, decode threads Default: 1                             \r\n"
+"                    e.g. 8 (raw binary unit files only)           \r\n\r\n"
+"    'K'eep devices, limit and policy Default: no limit            \r\n"
+"                    Least recently heard 'L'                      \r\n"
+"                    Oldest added         'O'                      \r\n"
+"                    e.g. 1000L                                    \r\n\r\n"
+"    'H'istory, packets kept per device Default: 1                 \r\n"
+"                    e.g. 60                                       \r\n\r\n"
+"    Link 'Q'uality file, packet ids lost/repeated per device      \r\n"
+"                    e.g. LINK.CSV (written on exit)               \r\n";
 
 // Prototypes
 int main(int argc, char *argv[]);
@@ -98,6 +141,12 @@ void PrintCLOPtions(void);
 void ErrorExit(const char* fmt,...);
 void CleanupOnExit(void);
 void RunApp(void);
+static void AppTimerTasks(void);
+#ifdef __linux__
+static int RunAppEvents(void);
+static void AppKeysRaw(int fd);
+static void AppKeysRestore(void);
+#endif
 
 /* Read loop */
 int main(int argc, char *argv[])
@@ -110,6 +159,9 @@ int main(int argc, char *argv[])
 	gSettings.format = 'E';
 	gSettings.encoding = 'H';
 	gSettings.input = "COM1";
+	gSettings.inputCount = 0;
+	gSettings.dedupeMs = SOURCE_DEDUPE_MS;
+	gSettings.framer = NULL;
 	gSettings.inputFile = NULL;
 	// Output
 	gSettings.output = 'S';
@@ -122,22 +174,36 @@ int main(int argc, char *argv[])
 	gSettings.baxInfoFile = NULL;
 	gSettings.baxInfoFileSetting = "BAX_INFO.BIN";
 	gSettings.baxConfigFile = "BAX_SETUP.CFG";
+	gSettings.allowFile = NULL;
+	gSettings.denyFile = NULL;
 	gSettings.localServer = NULL;
 	gSettings.remoteAddress = NULL;
 	gSettings.udpSocket = 0;
+	gSettings.udpRcvBuf = 0;
 	gSettings.udpState = NULL;
 	gSettings.ipAddress = "0.0.0.0";
 	gSettings.udpPort = BAX_UDP_PORT_FORWARDING;
+	gSettings.udpLocalPort = BAX_UDP_PORT_FORWARDING;
 	gSettings.destMac = "00-00-00-00-00-00";
 	gSettings.username = "admin";
 	gSettings.password = "password";
 	// Reader specific functions
 	gSettings.outPutc = NULL;
 	gSettings.inGetc = NULL;
+	gSettings.inRead = NULL;
+	gSettings.readTimeout = 1;
 	gSettings.fd = 0;
 	// Output tracking
 	gSettings.pktCount = 0;
 	gSettings.dataNum = 0;
+	// Offline decoding
+	gSettings.threads = 1;
+	gSettings.aesCode = 'N';
+	// Device table
+	gSettings.infoLimit = 0;
+	gSettings.infoEvict = BAX_EVICT_LRU;
+	gSettings.historyDepth = MAX_BAX_SAVED_PACKETS;
+	gSettings.linkFile = NULL;
 
 	// Read ARGS
 	if(argc > 1)argc--; // Decrement so it can be used as the index
@@ -198,6 +264,10 @@ int main(int argc, char *argv[])
 				case ('D'):
 				case ('d') : {
 					gSettings.input = &argv[argc][2];
+					if(gSettings.inputCount < MAX_INPUT_SOURCES)
+						gSettings.inputs[gSettings.inputCount++] = gSettings.input;
+					else
+						fprintf(stderr,"\r\nToo many descriptors, ignored %s",argv[argc]);
 					break;
 				}
 				case ('O'):
@@ -223,6 +293,10 @@ int main(int argc, char *argv[])
 						case 's': 
 						case 'C':
 						case 'c': 
+						case 'A':
+						case 'a': 
+						case 'B':
+						case 'b': 
 							gSettings.outMode =  toupper(argv[argc][2]);
 						default : break;
 					}
@@ -291,12 +365,31 @@ int main(int argc, char *argv[])
 							gSettings.linkMode |= LINK_FLAG_PAIR;
 							break;
 						}
+						case 'W':
+						case 'w': {
+							gSettings.linkMode |= LINK_FLAG_WATCH;
+							break;
+						}
 						default : break;
 					}
 					offset++;
 					}// while
 					break;
 				}
+				case ('A'):
+				case ('a'):{
+					switch (argv[argc][2]) {
+						case 'N':
+						case 'n': 
+						case 'T':
+						case 't': 
+						case 'B':
+						case 'b': 
+							gSettings.aesCode =  toupper(argv[argc][2]);
+						default : break;
+					}
+					break;
+				}
 				case ('I'):
 				case ('i') : {
 					gSettings.baxInfoFileSetting = &argv[argc][2];
@@ -307,6 +400,78 @@ int main(int argc, char *argv[])
 					gSettings.baxConfigFile = &argv[argc][2];
 					break;
 				}
+				case ('L'):
+				case ('l') : {
+					gSettings.allowFile = &argv[argc][2];
+					break;
+				}
+				case ('X'):
+				case ('x') : {
+					gSettings.denyFile = &argv[argc][2];
+					break;
+				}
+				case ('B'):
+				case ('b') : {
+					gSettings.udpRcvBuf = atoi(&argv[argc][2]);
+					break;
+				}
+				case ('W'):
+				case ('w') : {
+					// Comma separated window lengths
+					char* value = &argv[argc][2];
+					gSettings.windowCount = 0;
+					while(*value != '\0' && gSettings.windowCount < AGGREGATE_MAX_WINDOWS)
+					{
+						long window = strtol(value, &value, 10);
+						if(window > 0) gSettings.windows[gSettings.windowCount++] = (unsigned long)window;
+						if(*value != ',') break;
+						value++;
+					}
+					break;
+				}
+				case ('U'):
+				case ('u') : {
+					int window = atoi(&argv[argc][2]);
+					if(window < 0) window = 0;
+					if(window > 60000) window = 60000;
+					gSettings.dedupeMs = (unsigned short)window;
+					break;
+				}
+				case ('J'):
+				case ('j') : {
+					int threads = atoi(&argv[argc][2]);
+					if(threads < 1) threads = 1;
+					if(threads > OFFLINE_MAX_THREADS) threads = OFFLINE_MAX_THREADS;
+					gSettings.threads = threads;
+					break;
+				}
+				case ('K'):
+				case ('k') : {
+					char* policy;
+					gSettings.infoLimit = strtoul(&argv[argc][2], &policy, 10);
+					switch (*policy) {
+						case 'L':
+						case 'l': 
+						case 'O':
+						case 'o': 
+							gSettings.infoEvict = toupper(*policy);
+						default : break;
+					}
+					break;
+				}
+				case ('H'):
+				case ('h') : {
+					long depth = atol(&argv[argc][2]);
+					if(depth < 0) depth = 0;
+					if(depth > 0xFFFF) depth = 0xFFFF;
+					gSettings.historyDepth = (unsigned short)depth;
+					break;
+				}
+				case ('Q'):
+				case ('q') : {
+					gSettings.linkFile = &argv[argc][2];
+					break;
+				}
 				default: {
 					parsedArgs--;
 					fprintf(stderr,"\r\nUnknown command line option %s",argv[argc]);
@@ -325,6 +490,14 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	// Args are read last to first, put descriptors back in command line order
+	for(parsedArgs = 0; parsedArgs < gSettings.inputCount / 2; parsedArgs++)
+	{
+		char* swap = gSettings.inputs[parsedArgs];
+		gSettings.inputs[parsedArgs] = gSettings.inputs[gSettings.inputCount - 1 - parsedArgs];
+		gSettings.inputs[gSettings.inputCount - 1 - parsedArgs] = swap;
+	}
+
 	// Indicate debug on
 	DBG_INFO("Debug output on!");
 
@@ -360,13 +533,39 @@ void PrintCLOPtions(void)
 
 void RunApp(void)
 {
-	static unsigned long long lastTimeMs = 0;
-
 	// Now open BAX receiver (reader)
 	// Allow reader to try loading the info file
 	if(gSettings.linkMode & LINK_FLAG_FILE)
 		gSettings.baxInfoFile = gSettings.baxInfoFileSetting;
 
+	// Pick the AES code before any keys are loaded
+	if(gSettings.aesCode == 'B')		AesFastSelect(AES_LEVEL_PORTABLE);
+	else if(gSettings.aesCode == 'T')	AesFastSelect(AES_LEVEL_TABLE);
+	else								AesFastSelect(AES_LEVEL_NI);
+	// And the hex conversion, before any reader or decode threads start
+	HexSelect(HEX_LEVEL_AVX2);
+
+	// Address lists for dropping units before they are decrypted
+	if(!FilterOpen(gSettings.allowFile, gSettings.denyFile))
+		ErrorExit("Can not read address lists");
+
+	// Statistics per device instead of packets
+	if(gSettings.outMode == 'A')
+	{
+		if(gSettings.windowCount == 0)
+			gSettings.windows[gSettings.windowCount++] = AGGREGATE_DEFAULT_S;
+		if(!AggregateOpen(gSettings.windows, gSettings.windowCount))
+			ErrorExit("No usable aggregate windows");
+	}
+
+	// Decoded fields in column blocks
+	if(gSettings.outMode == 'B' && !ColumnsOpen())
+		ErrorExit("Can not make column blocks");
+
+	// Size the device table before any are added
+	BaxSetHistoryDepth(gSettings.historyDepth);
+	BaxSetInfoLimit(gSettings.infoLimit, gSettings.infoEvict);
+
 	if(gSettings.source == 'S' && gSettings.format == 'E')
 	{
 		// Init the receiver if in radio control mode
@@ -380,9 +579,26 @@ void RunApp(void)
 		BaxLoadInfoFile(gSettings.baxInfoFile);
 	}
 
+	// Merge the info file again whenever it is replaced
+	if((gSettings.linkMode & LINK_FLAG_WATCH) && gSettings.baxInfoFile != NULL)
+		InfoWatchOpen(gSettings.baxInfoFile);
+
 	// Stop reader adding to the file if this is disabled
 	if(!(gSettings.linkMode & LINK_FLAG_ADD))
 		gSettings.baxInfoFile = NULL;
+	// New devices and names are saved in batches
+	if(gSettings.baxInfoFile != NULL)
+		InfoStoreOpen(gSettings.baxInfoFile);
+
+	// Decode mapped unit files on several threads if requested
+	if(gSettings.threads > 1 && OfflineDecode(&gSettings))
+		return;
+
+#ifdef __linux__
+	// Block on input events where the input can be waited on
+	if(RunAppEvents())
+		return;
+#endif
 
 	while(gStatus.app_state != ERROR_STATE)
 	{
@@ -392,17 +608,7 @@ void RunApp(void)
 		TransportTasks(&gSettings);
 	
 		// Bax receiver tasks
-		if(gSettings.source == 'S' && gSettings.format == 'E')
-		{
-			unsigned long long now = MillisecondsEpoch();
-			if(lastTimeMs == 0) lastTimeMs = now;
-			// If we are controlling an actual radio dongle
-			else if((now - lastTimeMs) > 300000lu)
-			{
-				lastTimeMs = now;
-				TransportCheckHardware();
-			}
-		}
+		AppTimerTasks();
 
 		// Realtime user/caller stdin commands
 		// TODO:
@@ -410,12 +616,197 @@ void RunApp(void)
 	return;
 }
 
+// Periodic tasks, called at least every APP_TIMER_PERIOD_MS
+static void AppTimerTasks(void)
+{
+	static unsigned long long lastTimeMs = 0;
+	// Reloaded device info
+	InfoWatchTasks();
+	if(gSettings.source == 'S' && gSettings.format == 'E')
+	{
+		unsigned long long now = MillisecondsEpoch();
+		if(lastTimeMs == 0) lastTimeMs = now;
+		// If we are controlling an actual radio dongle
+		else if((now - lastTimeMs) > 300000lu)
+		{
+			lastTimeMs = now;
+			TransportCheckHardware();
+		}
+	}
+}
+
+#ifdef __linux__
+// Terminal settings to put back, saved when keys are read unbuffered
+static struct termios appTermios;
+static volatile sig_atomic_t appTermiosSaved = FALSE;
+
+// Put the terminal back before an interrupt ends the program, exit handlers are not run
+static void AppKeysSignal(int sig)
+{
+	if(appTermiosSaved) tcsetattr(STDIN_FILENO, TCSANOW, &appTermios);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+// Keys are read as they are pressed without echo, until AppKeysRestore
+static void AppKeysRaw(int fd)
+{
+	struct termios raw;
+	if(!isatty(fd) || tcgetattr(fd, &appTermios) != 0) return;
+	raw = appTermios;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &raw) != 0) return;
+	appTermiosSaved = TRUE;
+	signal(SIGINT, AppKeysSignal);
+	signal(SIGTERM, AppKeysSignal);
+	signal(SIGHUP, AppKeysSignal);
+}
+
+static void AppKeysRestore(void)
+{
+	if(!appTermiosSaved) return;
+	tcsetattr(STDIN_FILENO, TCSANOW, &appTermios);
+	appTermiosSaved = FALSE;
+}
+
+// Event driven version of the main loop, sleeps until the input, stdin or the timer is ready
+// Returns FALSE if the input can not be waited on so the caller polls it instead
+static int RunAppEvents(void)
+{
+	struct epoll_event evt, events[APP_MAX_EVENTS];
+	struct itimerspec period;
+	int epfd, inputFd, timerFd, keyFd;
+	int quit = FALSE;
+
+	inputFd = TransportWaitFd(&gSettings);
+	if(inputFd < 0) return FALSE;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0) return FALSE;
+
+	// Input
+	memset(&evt, 0, sizeof(evt));
+	evt.events = EPOLLIN;
+	evt.data.fd = inputFd;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, inputFd, &evt) != 0)
+	{
+		close(epfd);
+		return FALSE;
+	}
+	TransportNoWait(&gSettings);
+
+	// Timer for the periodic tasks
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timerFd >= 0)
+	{
+		period.it_interval.tv_sec = APP_TIMER_PERIOD_MS / 1000;
+		period.it_interval.tv_nsec = (APP_TIMER_PERIOD_MS % 1000) * 1000000l;
+		period.it_value = period.it_interval;
+		evt.data.fd = timerFd;
+		if(timerfd_settime(timerFd, 0, &period, NULL) != 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &evt) != 0)
+		{
+			DBG_ERROR("Timer unavailable");
+			close(timerFd);
+			timerFd = -1;
+		}
+	}
+
+	// Stdin for the exit key (not pollable if redirected from a file)
+	keyFd = fileno(stdin);
+	evt.data.fd = keyFd;
+	if(keyFd == inputFd || epoll_ctl(epfd, EPOLL_CTL_ADD, keyFd, &evt) != 0)
+		keyFd = -1;
+	// ESC is seen without waiting for return
+	if(keyFd >= 0)
+		AppKeysRaw(keyFd);
+
+	DBG_INFO("\r\nEvent loop started");
+	while(!quit && gStatus.app_state != ERROR_STATE)
+	{
+		int i, count;
+		count = epoll_wait(epfd, events, APP_MAX_EVENTS, -1);
+		if(count < 0)
+		{
+			if(errno == EINTR) continue;
+			DBG_ERROR("Event wait failed");
+			break;
+		}
+		for(i = 0; i < count; i++)
+		{
+			int fd = events[i].data.fd;
+			if(fd == inputFd)
+			{
+				// Handle everything the input has ready
+				while(gStatus.app_state != ERROR_STATE && TransportTasks(&gSettings) > 0);
+				if(events[i].events & (EPOLLHUP | EPOLLERR))
+				{
+					DBG_ERROR("Input closed");
+					quit = TRUE;
+				}
+			}
+			else if(fd == timerFd)
+			{
+				uint64_t expirations;
+				if(read(timerFd, &expirations, sizeof(expirations)) <= 0) continue;
+				AppTimerTasks();
+				// Udp lease is otherwise only renewed when packets arrive
+				if(gSettings.source == 'U')
+					UdpCheckSession(&gSettings);
+			}
+			else if(fd == keyFd)
+			{
+				unsigned char key;
+				if(read(keyFd, &key, 1) <= 0)
+				{
+					// Stdin closed, stop watching it
+					epoll_ctl(epfd, EPOLL_CTL_DEL, keyFd, NULL);
+					keyFd = -1;
+				}
+				else if(key == 27)
+				{
+					quit = TRUE;	// Exit on ESC hit
+				}
+			}
+		}
+	}
+
+	if(timerFd >= 0) close(timerFd);
+	close(epfd);
+	return TRUE;
+}
+#endif
+
 void CleanupOnExit(void)
 {
 	// Cleanup code....
 
+#ifdef __linux__
+	// Terminal back as it was
+	AppKeysRestore();
+#endif
 	// Close port
 	CloseTransport(&gSettings);
+	// Packet id counts
+	if(gSettings.linkFile != NULL)
+	{
+		FILE* linkFile = fopen(gSettings.linkFile, "w");
+		if(linkFile != NULL)
+		{
+			fprintf(linkFile, "Address,Name,Received,Lost,Duplicate,Reordered\r\n");
+			BaxSaveLinkStats(linkFile);
+			fclose(linkFile);
+		}
+		else fprintf(stderr, "\r\nCan not write %s", gSettings.linkFile);
+	}
+	// Stop reloading and save new device info
+	InfoWatchClose();
+	InfoStoreClose();
+	// Free address lists
+	FilterClose();
+	// Last aggregate windows and column block
+	AggregateClose();
+	ColumnsClose();
 	// Close log file
 	CloseOutput(&gSettings);
 